@@ -0,0 +1,27 @@
+;;;; Benchmark for fixnum arithmetic and comparisons, the common case the
+;;;; numeric tower has to keep fast. Nothing here overflows a fixnum.
+;;;; Doesn't need lib.scm. Run with:
+;;;;   time ./bootstrap/bootstrap < bench/arith.scm
+;;;; or on the vm:
+;;;;   make bench/arith.sbc && time ./vm/vm bench/arith.sbc
+
+(define (sum-squares i n acc)
+	(if (> i n)
+		acc
+		(sum-squares (+ i 1) n (+ acc (* i i)))))
+
+(define (count-down n acc)
+	(if (< n 1)
+		acc
+		(count-down (- n 1) (- acc (quotient n 3)))))
+
+(define (repeat n)
+	(if (= n 0)
+		'done
+		(begin
+			(sum-squares 1 1000 0)
+			(count-down 1000 0)
+			(repeat (- n 1)))))
+
+(repeat 1000)
+(exit)
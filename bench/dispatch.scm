@@ -0,0 +1,15 @@
+;;;; Microbenchmark for special form dispatch in the bootstrap interpreter.
+;;;; Every iteration makes three procedure calls and evaluates an IF, so
+;;;; almost all of the time goes on deciding what kind of form each pair is.
+;;;; Doesn't need lib.scm. Run with:
+;;;;   time ./bootstrap/bootstrap < bench/dispatch.scm
+
+(define (id x) x)
+
+(define (loop n)
+	(if (= n 0)
+		'done
+		(loop (id (- n 1)))))
+
+(loop 1000000)
+(exit)
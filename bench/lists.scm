@@ -0,0 +1,17 @@
+;;;; Benchmark for the list library: append, reverse, length, memq, map
+;;;; and the c...r functions over a 2000 element list, 100 times.
+;;;; Run with:
+;;;;   time ./bootstrap/bootstrap < bench/lists.scm
+
+(load "bootstrap/lib.scm")
+(define l (range 0 2000))
+(define (loop n)
+	(if (= n 0)
+		'done
+		(begin
+			(length (reverse (append l l)))
+			(memq 1999 l)
+			(map cadr (map (lambda (x) (list x x)) l))
+			(loop (- n 1)))))
+(loop 100)
+(exit)
@@ -0,0 +1,43 @@
+;;;; Benchmark for the reader. Writes about 8MB of code-like data to a
+;;;; temporary file, then reads it back five times, so most of the time
+;;;; goes on scanning, interning symbols and consing. Doesn't need lib.scm.
+;;;; Run with:
+;;;;   time ./bootstrap/bootstrap < bench/read.scm
+
+(define form
+	'(define (compile-expression x env tail?)
+		(cond
+			((symbol? x) (compile-ref x env))
+			((pair? x) (compile-form (car x) (cdr x) env tail?))
+			(else (list 'const x "a string, with \"escapes\"" -12345 67890 #\a #t)))))
+
+(define (write-forms port n)
+	(if (= n 0)
+		'done
+		(begin
+			(write form port)
+			(write-char #\newline port)
+			(write-forms port (- n 1)))))
+
+(define (read-all port n)
+	(if (eof-object? (read port))
+		n
+		(read-all port (+ n 1))))
+
+(define (read-file name)
+	(let ((port (open-input-file name)))
+		(let ((n (read-all port 0)))
+			(close-input-file port)
+			n)))
+
+(define out (open-output-file "bench/read.tmp"))
+(write-forms out 40000)
+(close-output-file out)
+
+(read-file "bench/read.tmp")
+(read-file "bench/read.tmp")
+(read-file "bench/read.tmp")
+(read-file "bench/read.tmp")
+(read-file "bench/read.tmp")
+(system "rm bench/read.tmp")
+(exit)
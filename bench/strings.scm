@@ -0,0 +1,23 @@
+;;;; Benchmark for building a long string a piece at a time, the way the
+;;;; compiler's C backend builds its output. Each step adds about 20
+;;;; characters, 5000 times, by string-append, then by a string port.
+;;;; Doesn't need lib.scm. Run with:
+;;;;   time ./bootstrap/bootstrap < bench/strings.scm
+
+(define piece "(cons (car x) rest) ")
+
+(define (by-append n acc)
+	(if (= n 0)
+		acc
+		(by-append (- n 1) (string-append acc piece))))
+
+(define (by-port n port)
+	(if (= n 0)
+		(get-output-string port)
+		(begin
+			(display piece port)
+			(by-port (- n 1) port))))
+
+(string-length (by-append 5000 ""))
+(string-length (by-port 5000 (open-output-string)))
+(exit)
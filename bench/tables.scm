@@ -0,0 +1,28 @@
+;;;; Benchmark for looking symbols up in a table, as the compiler does
+;;;; with its enviroments and hooks: 200 keys, each looked up 200 times,
+;;;; first in an alist with assq, then in a hash table. Needs lib.scm.
+;;;; Run with:
+;;;;   time ./bootstrap/bootstrap < bench/tables.scm
+
+(load "bootstrap/lib.scm")
+
+(define (make-keys n)
+	(if (= n 0)
+		'()
+		(cons (string->symbol (string-append "key" (number->string n))) (make-keys (- n 1)))))
+
+(define keys (make-keys 200))
+(define alist (map (lambda (key) (cons key key)) keys))
+(define table (make-hash-table))
+(for-each (lambda (key) (hash-table-set! table key key)) keys)
+
+(define (look-up-all find n)
+	(if (= n 0)
+		'done
+		(begin
+			(for-each find keys)
+			(look-up-all find (- n 1)))))
+
+(look-up-all (lambda (key) (assq key alist)) 200)
+(look-up-all (lambda (key) (hash-table-ref table key)) 200)
+(exit)
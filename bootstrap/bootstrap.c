@@ -1,10 +1,9 @@
 /* 
  * A quick and dirty scheme interpreter for bootstrapping the 
  * compiler for the first time. Has pairs, lambdas, strings, 
- * integers, characters, symbols, and IO, but no vectors or macros 
- * or continuations as they are not needed by the compiler. 
- * Includes a very simple reference-counting GC that will leak 
- * some memory, but it only runs for a short time so it's OK.
+ * numbers, characters, symbols, vectors, bytevectors and IO, but no
+ * macros or continuations as they are not needed by the compiler. 
+ * Memory is managed by a precise mark-sweep collector.
  * Based on
  * http://michaux.ca/articles/scheme-from-scratch-introduction.
  */
@@ -13,38 +12,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bootstrap.h"
+#include "object.h"
 
 /*
  * DATA
  */
 
 
-struct object {
-	enum obj_type type;
-	int refs;
-	union {
-		char c;
-		int i;
-		struct {
-			struct object *car;
-			struct object *cdr;
-		} pair;
-		char *str;
-		prim_proc prim;
-		struct {
-			struct object *env;
-			struct object *args;
-			struct object *code;
-		} lambda;
-		struct {
-			int direction;
-			FILE *handle;
-		} port;
-	} data;
-};
+object *global_enviroment;
 
-static object *symbol_table;
+/* 
+ * The symbol table is an open addressing hash table with linear probing.
+ * Symbols are allocated old, so they never move.
+ */
+static object **symbol_table;
+static size_t symbol_table_size, symbol_count;
 
 static char *type_name(enum obj_type type)
 {
@@ -58,141 +46,702 @@ static char *type_name(enum obj_type type)
 	case scm_char:
 		return "a character";
 	case scm_int: 
-		return "a number";
+		return "a fixnum";
+	case scm_bignum:
+		return "a bignum";
+	case scm_flonum:
+		return "a flonum";
 	case scm_pair:
 		return "a pair";
 	case scm_symbol:
 		return "a symbol";
 	case scm_prim_fun:
 	case scm_lambda:
+	case scm_closure:
 		return "a function";
 	case scm_str:
 		return "a string";
 	case scm_file:
 		return "a port";
+	case scm_node:
+		return "analyzed code";
+	case scm_frame:
+		return "an enviroment frame";
+	case scm_code:
+		return "compiled code";
+	case scm_vector:
+		return "a vector";
+	case scm_bytevector:
+		return "a bytevector";
+	case scm_table:
+		return "a hash table";
 	default:
 		return "unknown"; /* this shouldn't happen */
 	}
 }
 
+static inline enum obj_type type_of(object *obj)
+{
+	if (is_fixnum(obj))
+		return scm_int;
+	if (is_char(obj))
+		return scm_char;
+	switch ((uintptr_t) obj){
+	case (uintptr_t) false:
+	case (uintptr_t) true:
+		return scm_bool;
+	case (uintptr_t) empty_list:
+		return scm_empty_list;
+	case (uintptr_t) eof:
+		return scm_eof;
+	}
+	return obj->type;
+}
+
 int check_type(enum obj_type type, object *obj, int err_on_false)
 {
-	int result = (type == obj->type);
+	int result = is_immediate(obj) ? type == type_of(obj) : type == obj->type;
 	if (!result && err_on_false){
 		fprintf(stderr, "Type error: expecting %s, got %s.\n", 
-			type_name(type), type_name(obj->type));
+			type_name(type), type_name(type_of(obj)));
 		exit(1);
 	}
 	return result;
 }
 
 
-static object *alloc_obj(void)
+/*
+ * Memory management
+ *
+ * A generational collector. New pairs and lambdas are bump allocated 
+ * in the nursery (integers and characters are immediates, see 
+ * bootstrap.h, and never allocated). A minor collection copies the
+ * nursery objects that are still reachable into the old space, which
+ * is collected by mark-sweep. Objects that own malloced data (strings, 
+ * symbols, bignums, ports and compiled code) are allocated old so that dead nursery objects 
+ * never need finalising.
+ *
+ * Enviroment frames are the only objects whose size varies. In the 
+ * nursery a frame takes as many consecutive slots as its variables 
+ * need, and in the old space each frame is malloced on its own and 
+ * kept on the large_objects list.
+ *
+ * The old space is made of page sized chunks of object slots. Each 
+ * chunk only holds objects of one type, and free slots are kept on an
+ * intrusive free list per type, so promoted pairs end up next to each
+ * other. Chunks that are completely empty are only given back to the 
+ * system by gc_trim, which load calls when it finishes.
+ *
+ * The roots are the symbol table (which holds the values of global 
+ * variables), the global enviroment, the root stack, which holds the
+ * addresses of C variables registered with gc_protect, the stacks
+ * registered with gc_protect_stack (the vm's), and the evaluator's
+ * stack. Old objects that have had a pointer to a nursery object 
+ * stored in them are kept in the remembered set by the write barrier 
+ * in set_car, set_cdr, frame_set and set_global.
+ *
+ * Collections only happen at safe points (each step of the evaluator), 
+ * never inside alloc_obj, so code that doesn't call eval can hold 
+ * unprotected objects in C variables. As minor collections move 
+ * objects, variables that are live across a call to eval must be 
+ * protected even if the object is reachable some other way.
+ */
+
+#define NURSERY_SIZE (1 << 17)      /* in objects */
+#define GC_MIN_THRESHOLD 100000
+
+#define FORWARDED 2                 /* value of marked for a promoted nursery object */
+#define FREE 3                      /* value of marked for an unused old space slot */
+
+#define CHUNK_BYTES 4096
+
+struct chunk {
+	struct chunk *next;
+	int live;
+	object slots[];
+};
+
+#define CHUNK_SLOTS ((CHUNK_BYTES - sizeof(struct chunk)) / sizeof(object))
+
+static object *nursery, *nursery_top, *nursery_end;
+static object *large_objects;       /* old frames and vectors, linked through next */
+
+static struct chunk *chunks[scm_num_types];
+static object *free_lists[scm_num_types];
+
+static long heap_live;              /* objects that survived the last major collection */
+static long old_allocs_since_gc;
+static long gc_threshold = GC_MIN_THRESHOLD;
+
+static struct gc_stats stats;
+
+static object ***gc_roots;
+static int gc_roots_count, gc_roots_size;
+
+#define MAX_STACKS 4
+static struct {
+	object **bottom;
+	object ***top;
+} gc_stacks[MAX_STACKS];
+static int gc_stacks_count;
+
+/* scanned like gc_stacks, but it moves when it grows, see run */
+static object **eval_stack, **eval_sp, **eval_stack_end;
+
+static object **mark_stack;         /* also the scan queue for minor collections */
+static int mark_stack_count, mark_stack_size;
+
+static object **remembered;
+static int remembered_count, remembered_size;
+
+static void *grow(void *array, int *size, int elem_size)
+{
+	*size = *size ? *size * 2 : 256;
+	array = realloc(array, *size * elem_size);
+	if (array == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return array;
+}
+
+void gc_protect(object **root)
+{
+	if (gc_roots_count == gc_roots_size)
+		gc_roots = grow(gc_roots, &gc_roots_size, sizeof(object **));
+	gc_roots[gc_roots_count++] = root;
+}
+
+void gc_protect_stack(object **bottom, object ***top)
+{
+	if (gc_stacks_count == MAX_STACKS){
+		fprintf(stderr, "Too many stacks registered with the collector.\n");
+		exit(1);
+	}
+	gc_stacks[gc_stacks_count].bottom = bottom;
+	gc_stacks[gc_stacks_count].top = top;
+	gc_stacks_count++;
+}
+
+int gc_depth(void)
+{
+	return gc_roots_count;
+}
+
+void gc_release(int depth)
+{
+	gc_roots_count = depth;
+}
+
+static inline int in_nursery(object *obj)
+{
+	return obj >= nursery && obj < nursery_end;
+}
+
+static void remember(object *obj)
+{
+	if (obj->marked)
+		return;
+	obj->marked = 1;
+	if (remembered_count == remembered_size)
+		remembered = grow(remembered, &remembered_size, sizeof(object *));
+	remembered[remembered_count++] = obj;
+}
+
+int is_young(object *obj)
+{
+	return in_nursery(obj);
+}
+
+inline void write_barrier(object *obj, object *new)
+{
+	if (in_nursery(new) && !in_nursery(obj))
+		remember(obj);
+}
+
+static void init_heap(void)
+{
+	nursery = malloc(NURSERY_SIZE * sizeof(object));
+	if (nursery == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	nursery_top = nursery;
+	nursery_end = nursery + NURSERY_SIZE;
+}
+
+static void new_chunk(enum obj_type type)
+{
+	struct chunk *chunk = malloc(CHUNK_BYTES);
+	int i;
+	if (chunk == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	chunk->next = chunks[type];
+	chunks[type] = chunk;
+	chunk->live = 0;
+	for (i = CHUNK_SLOTS - 1; i >= 0; i--){
+		chunk->slots[i].marked = FREE;
+		chunk->slots[i].next = free_lists[type];
+		free_lists[type] = &chunk->slots[i];
+	}
+	stats.chunks++;
+}
+
+/* the allocators, gc_safe_point and write_barrier are exported for the
+ * vm, but inline so that calls in this file stay cheap */
+inline object *alloc_old(enum obj_type type)
 {
 	object *obj;
-	obj = malloc(sizeof(object));
-	if (obj == NULL)
-	{
+	if (free_lists[type] == NULL)
+		new_chunk(type);
+	obj = free_lists[type];
+	free_lists[type] = obj->next;
+	obj->type = type;
+	obj->marked = 0;
+	old_allocs_since_gc++;
+	stats.old_allocs++;
+	return obj;
+}
+
+static object *alloc_large(enum obj_type type, int size)
+{
+	object *obj = malloc(sizeof(object) + size * sizeof(object *));
+	if (obj == NULL){
 		fprintf(stderr, "Out of memory.\n");
 		exit(1);
 	}
-	obj->refs = 0;
+	obj->type = type;
+	obj->marked = 0;
+	obj->next = large_objects;
+	large_objects = obj;
+	obj->data.frame.size = size;
+	old_allocs_since_gc++;
+	stats.old_allocs++;
 	return obj;
 }
 
-static void decrement_refs(object *obj)
+/* a frame or a vector, with size slots after the header */
+static object *alloc_slots(enum obj_type type, int size)
 {
-	if(--(obj->refs) || obj == true || obj == false || 
-		 obj == empty_list || obj == eof)
-		return;
+	size_t units = 1 + (size * sizeof(object *) + sizeof(object) - 1) / sizeof(object);
+	object *obj;
+	stats.allocs++;
+	if (nursery_end - nursery_top >= units){
+		obj = nursery_top;
+		nursery_top += units;
+		obj->type = type;
+		obj->marked = 0;
+		obj->data.frame.size = size;
+		return obj;
+	}
+	obj = alloc_large(type, size); /* as in alloc_obj */
+	stats.allocs--;
+	remember(obj);
+	return obj;
+}
+
+object *alloc_frame(int size)
+{
+	return alloc_slots(scm_frame, size);
+}
+
+inline object *alloc_obj(enum obj_type type)
+{
+	object *obj;
+	stats.allocs++;
+	if (nursery_top < nursery_end){
+		obj = nursery_top++;
+		obj->type = type;
+		obj->marked = 0;
+		return obj;
+	}
+	/* 
+	 * The nursery filled up between safe points. The new object 
+	 * goes in the old space, but is remembered because whatever 
+	 * gets stored in it is likely to be young.
+	 */
+	obj = alloc_old(type);
+	stats.allocs--; /* counted in old_allocs */
+	remember(obj);
+	return obj;
+}
+
+static void push(object *obj)
+{
+	if (mark_stack_count == mark_stack_size)
+		mark_stack = grow(mark_stack, &mark_stack_size, sizeof(object *));
+	mark_stack[mark_stack_count++] = obj;
+}
+
+/* returns obj's old space address, copying it there if necessary */
+static object *promote(object *obj)
+{
+	object *copy;
+	if (is_immediate(obj) || !in_nursery(obj))
+		return obj;
+	if (obj->marked == FORWARDED)
+		return obj->next;
+
+	if (obj->type == scm_frame || obj->type == scm_vector){
+		copy = alloc_large(obj->type, obj->data.frame.size);
+		memcpy(FRAME_SLOTS(copy), FRAME_SLOTS(obj), obj->data.frame.size * sizeof(object *));
+	} else
+		copy = alloc_old(obj->type);
+	copy->data = obj->data;
+	stats.promoted++;
+	obj->marked = FORWARDED;
+	obj->next = copy;
+	push(copy);
+	return copy;
+}
 
+static void promote_fields(object *obj)
+{
+	int i;
 	switch(obj->type){
+	case scm_symbol:
+		obj->data.sym.value = promote(obj->data.sym.value);
+		break;
 	case scm_pair:
-		decrement_refs(obj->data.pair.car);
-		decrement_refs(obj->data.pair.cdr);
+		obj->data.pair.car = promote(obj->data.pair.car);
+		obj->data.pair.cdr = promote(obj->data.pair.cdr);
+		break;
+	case scm_lambda:
+		obj->data.lambda.env = promote(obj->data.lambda.env);
+		obj->data.lambda.args = promote(obj->data.lambda.args);
+		obj->data.lambda.code = promote(obj->data.lambda.code);
+		break;
+	case scm_node:
+		obj->data.node.a = promote(obj->data.node.a);
+		obj->data.node.b = promote(obj->data.node.b);
+		obj->data.node.c = promote(obj->data.node.c);
 		break;
+	case scm_frame:
+	case scm_vector:
+		obj->data.frame.parent = promote(obj->data.frame.parent);
+		for (i = 0; i < obj->data.frame.size; i++)
+			FRAME_SLOTS(obj)[i] = promote(FRAME_SLOTS(obj)[i]);
+		break;
+	case scm_code:
+		for (i = 0; i < obj->data.code.nrelocs; i++)
+			obj->data.code.insns[obj->data.code.relocs[i]] = 
+				promote(obj->data.code.insns[obj->data.code.relocs[i]]);
+		break;
+	case scm_closure:
+		obj->data.closure.env = promote(obj->data.closure.env);
+		obj->data.closure.code = promote(obj->data.closure.code);
+		break;
+	case scm_table:
+		obj->data.table.slots = promote(obj->data.table.slots);
+		obj->data.table.old_slots = promote(obj->data.table.old_slots);
+		break;
+	default: /* no references to other objects */
+		break;
+	}
+}
+
+static void minor_collect(void)
+{
+	object **slot;
+	int i;
+
+	global_enviroment = promote(global_enviroment);
+	for (i = 0; i < gc_roots_count; i++)
+		if (*gc_roots[i] != NULL)
+			*gc_roots[i] = promote(*gc_roots[i]);
+	for (i = 0; i < gc_stacks_count; i++)
+		for (slot = gc_stacks[i].bottom; slot < *gc_stacks[i].top; slot++)
+			*slot = promote(*slot);
+	for (slot = eval_stack; slot < eval_sp; slot++)
+		*slot = promote(*slot);
+
+	for (i = 0; i < remembered_count; i++){
+		remembered[i]->marked = 0;
+		promote_fields(remembered[i]);
+	}
+	remembered_count = 0;
+
+	/* Cheney style scan, but the queue is a stack */
+	while (mark_stack_count)
+		promote_fields(mark_stack[--mark_stack_count]);
+
+	nursery_top = nursery;
+	stats.minor_collections++;
+}
+
+static void mark(object *obj)
+{
+	if (obj == NULL || is_immediate(obj) || obj->marked)
+		return;
+	obj->marked = 1;
+	push(obj);
+}
+
+/* an explicit stack rather than recursion, so long lists can't overflow the C stack */
+static void trace(void)
+{
+	object *obj;
+	int i;
+	while (mark_stack_count){
+		obj = mark_stack[--mark_stack_count];
+		switch(obj->type){
+		case scm_symbol:
+			mark(obj->data.sym.value);
+			break;
+		case scm_pair:
+			mark(obj->data.pair.car);
+			mark(obj->data.pair.cdr);
+			break;
+		case scm_lambda:
+			mark(obj->data.lambda.env);
+			mark(obj->data.lambda.args);
+			mark(obj->data.lambda.code);
+			break;
+		case scm_node:
+			mark(obj->data.node.a);
+			mark(obj->data.node.b);
+			mark(obj->data.node.c);
+			break;
+		case scm_frame:
+		case scm_vector:
+			mark(obj->data.frame.parent);
+			for (i = 0; i < obj->data.frame.size; i++)
+				mark(FRAME_SLOTS(obj)[i]);
+			break;
+		case scm_code:
+			for (i = 0; i < obj->data.code.nrelocs; i++)
+				mark(obj->data.code.insns[obj->data.code.relocs[i]]);
+			break;
+		case scm_closure:
+			mark(obj->data.closure.env);
+			mark(obj->data.closure.code);
+			break;
+		case scm_table:
+			mark(obj->data.table.slots);
+			mark(obj->data.table.old_slots);
+			break;
+		default: /* no references to other objects */
+			break;
+		}
+	}
+}
+
+static void free_obj(object *obj)
+{
+	switch(obj->type){
 	case scm_str:
+		free(obj->data.str.chars);
+		break;
 	case scm_symbol:
-		free(obj->data.str);
+		free(obj->data.sym.name);
 		break;
-	case scm_lambda:
-		decrement_refs(obj->data.lambda.env);
-		decrement_refs(obj->data.lambda.args);
-		decrement_refs(obj->data.lambda.code);
+	case scm_bignum:
+		free(obj->data.big.digits);
+		break;
+	case scm_bytevector:
+		free(obj->data.bytevector.bytes);
 		break;
 	case scm_file:
-		fclose(obj->data.port.handle);
+		if (obj->data.port.in != NULL)
+			close_source(obj->data.port.in);
+		else if (obj->data.port.handle != NULL)
+			fclose(obj->data.port.handle);
+		free(obj->data.port.string);
+		break;
+	case scm_code:
+		if (obj->data.code.release != NULL)
+			obj->data.code.release(obj);
+		else {
+			free(obj->data.code.insns);
+			free(obj->data.code.relocs);
+		}
+		break;
+	default:
 		break;
-	/*no default branch necassary */
 	}
-	free(obj);
+	obj->marked = FREE;
 }
 
-object *make_int(int value)
+static void sweep(enum obj_type type)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_int;
-	obj->data.i = value;
-	return obj;
+	struct chunk *chunk;
+	object *obj;
+	int i;
+
+	free_lists[type] = NULL;
+	for (chunk = chunks[type]; chunk != NULL; chunk = chunk->next){
+		chunk->live = 0;
+		for (i = CHUNK_SLOTS - 1; i >= 0; i--){
+			obj = &chunk->slots[i];
+			if (obj->marked == 1){
+				obj->marked = 0;
+				chunk->live++;
+				continue;
+			}
+			if (obj->marked != FREE)
+				free_obj(obj);
+			obj->next = free_lists[type];
+			free_lists[type] = obj;
+		}
+		heap_live += chunk->live;
+	}
 }
 
-int obj2int(object *obj)
+static void sweep_large(void)
 {
-	check_type(scm_int, obj, 1);
-	return obj->data.i;
+	object **link = &large_objects, *obj;
+
+	while ((obj = *link) != NULL){
+		if (obj->marked == 1){
+			obj->marked = 0;
+			heap_live++;
+			link = &obj->next;
+		} else {
+			*link = obj->next;
+			free(obj);
+		}
+	}
 }
 
-object *make_bool(int value)
+/* a full collection: empties the nursery then mark-sweeps the old space */
+void gc_collect(void)
 {
-	return value ? true : false;
+	object **slot;
+	int i;
+
+	minor_collect();
+
+	for (i = 0; i < symbol_table_size; i++)
+		mark(symbol_table[i]);
+	mark(global_enviroment);
+	for (i = 0; i < gc_roots_count; i++)
+		mark(*gc_roots[i]);
+	for (i = 0; i < gc_stacks_count; i++)
+		for (slot = gc_stacks[i].bottom; slot < *gc_stacks[i].top; slot++)
+			mark(*slot);
+	for (slot = eval_stack; slot < eval_sp; slot++)
+		mark(*slot);
+	trace();
+
+	heap_live = 0;
+	for (i = 0; i < scm_num_types; i++)
+		sweep(i);
+	sweep_large();
+
+	old_allocs_since_gc = 0;
+	gc_threshold = heap_live > GC_MIN_THRESHOLD ? heap_live : GC_MIN_THRESHOLD;
+	stats.major_collections++;
+	stats.live = heap_live;
 }
 
-int obj2bool(object *obj)
+/* does a full collection and releases the chunks that are left empty */
+void gc_trim(void)
 {
-	check_type(scm_bool, obj, 1);
-	return obj == true ? 1 : 0;
+	struct chunk **link, *chunk, *empty;
+	int i, k;
+
+	gc_collect();
+	for (i = 0; i < scm_num_types; i++){
+		empty = NULL;
+		free_lists[i] = NULL;
+		for (link = &chunks[i]; (chunk = *link) != NULL; ){
+			if (!chunk->live){
+				*link = chunk->next;
+				chunk->next = empty;
+				empty = chunk;
+				continue;
+			}
+			/* rethread the free list through the chunks that are kept */
+			for (k = CHUNK_SLOTS - 1; k >= 0; k--)
+				if (chunk->slots[k].marked == FREE){
+					chunk->slots[k].next = free_lists[i];
+					free_lists[i] = &chunk->slots[k];
+				}
+			link = &chunk->next;
+		}
+		while ((chunk = empty) != NULL){
+			empty = chunk->next;
+			free(chunk);
+			stats.chunks--;
+		}
+	}
 }
 
-object *make_char(char c)
+struct gc_stats *gc_statistics(void)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_char;
-	obj->data.c = c;
-	return obj;
+	return &stats;
 }
 
-char obj2char(object *obj)
+inline void gc_safe_point(void)
 {
-	check_type(scm_char, obj, 1);
-	return obj->data.c;
+	if (nursery_top < nursery_end - NURSERY_SIZE / 8)
+		return;
+	if (old_allocs_since_gc >= gc_threshold)
+		gc_collect();
+	else
+		minor_collect();
 }
 
 object *make_str(char *str)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_str;
-	obj->data.str = strdup(str);
-	if (obj->data.str == NULL){
+	return make_str_len(str, strlen(str));
+}
+
+object *make_str_len(char *chars, size_t length)
+{
+	object *obj = alloc_old(scm_str);
+	obj->data.str.chars = malloc(length + 1);
+	if (obj->data.str.chars == NULL){
 		fprintf(stderr, "Out of memory.\n");
 		exit(1);
 	}
+	if (chars != NULL)
+		memcpy(obj->data.str.chars, chars, length);
+	obj->data.str.chars[length] = '\0';
+	obj->data.str.length = obj->data.str.capacity = length;
 	return obj;
 }
 
 char *obj2str(object *obj)
 {
 	check_type(scm_str, obj, 1);
-	return obj->data.str;
+	return obj->data.str.chars;
+}
+
+size_t str_length(object *obj)
+{
+	check_type(scm_str, obj, 1);
+	return obj->data.str.length;
+}
+
+void str_append_str(object *str, object *more)
+{
+	size_t length = str_length(str), more_length = str_length(more);
+	size_t capacity = str->data.str.capacity;
+
+	if (length + more_length > capacity){
+		while (length + more_length > capacity)
+			capacity = capacity < 8 ? 16 : capacity * 2;
+		str->data.str.chars = realloc(str->data.str.chars, capacity + 1);
+		if (str->data.str.chars == NULL){
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		str->data.str.capacity = capacity;
+	}
+	/* more can be str, so its chars are only looked at after the realloc */
+	memcpy(str->data.str.chars + length, more->data.str.chars, more_length);
+	str->data.str.length += more_length;
+	str->data.str.chars[str->data.str.length] = '\0';
 }
 
 object *cons(object *car, object *cdr)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_pair;
+	object *obj = alloc_obj(scm_pair);
 	obj->data.pair.car = car;
 	obj->data.pair.cdr = cdr;
-	car->refs++;
-	cdr->refs++;
 	return obj;
 }
 
@@ -211,73 +760,138 @@ object *cdr(object *obj)
 void set_car(object *pair, object *new)
 {
 	check_type(scm_pair, pair, 1);
-	new->refs++;
-	decrement_refs(car(pair));
+	write_barrier(pair, new);
 	pair->data.pair.car = new;
 }
 
 void set_cdr(object *pair, object *new)
 {
 	check_type(scm_pair, pair, 1);
-	new->refs++;
-	decrement_refs(cdr(pair));
+	write_barrier(pair, new);
 	pair->data.pair.cdr = new;
 }
 
-object *make_symbol(char *name)
+static inline void frame_set(object *frame, int index, object *new)
 {
-	object *obj = make_str(name);
-	obj->type = scm_symbol;
+	write_barrier(frame, new);
+	FRAME_SLOTS(frame)[index] = new;
+}
+
+/* FNV-1a */
+#define HASH_START 2166136261u
+#define HASH_STEP(hash, c) (((hash) ^ (unsigned char) (c)) * 16777619u)
+
+static uint32_t hash_string(char *str, size_t *len)
+{
+	uint32_t hash = HASH_START;
+	char *p;
+	for (p = str; *p != '\0'; p++)
+		hash = HASH_STEP(hash, *p);
+	*len = p - str;
+	return hash;
+}
+
+static object *make_symbol_hashed(char *name, uint32_t hash, size_t len)
+{
+	object *obj = alloc_old(scm_symbol);
+	obj->data.sym.name = malloc(len + 1);
+	if (obj->data.sym.name == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	memcpy(obj->data.sym.name, name, len + 1);
+	obj->data.sym.hash = hash;
+	obj->data.sym.len = len;
+	obj->data.sym.value = NULL;
+	obj->data.sym.syntax = not_syntax;
 	return obj;
 }
 
+object *make_symbol(char *name)
+{
+	size_t len;
+	uint32_t hash = hash_string(name, &len);
+	return make_symbol_hashed(name, hash, len);
+}
+
 char *sym2str(object *obj)
 {
 	check_type(scm_symbol, obj, 1);
-	return obj->data.str;
+	return obj->data.sym.name;
 }
 
-object *get_symbol(char *name)
+static void grow_symbol_table(void)
 {
-	/* 
-	 * This is a slow algorithm (O(n))
-	 * but it's the simplest one and 
-	 * speed isn't important here so
-	 * it's ok.
-	 */
+	object **old = symbol_table;
+	size_t old_size = symbol_table_size, i, j;
 
-	object *sym, *table;
-	for(table = symbol_table; table != empty_list; table = cdr(table))
-		if(!strcmp(name, sym2str(car(table))))
-			return car(table);
+	symbol_table_size = old_size ? old_size * 2 : 1024;
+	symbol_table = calloc(symbol_table_size, sizeof(object *));
+	if (symbol_table == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (i = 0; i < old_size; i++){
+		if (old[i] == NULL)
+			continue;
+		j = old[i]->data.sym.hash & (symbol_table_size - 1);
+		while (symbol_table[j] != NULL)
+			j = (j + 1) & (symbol_table_size - 1);
+		symbol_table[j] = old[i];
+	}
+	free(old);
+}
 
-	sym = make_symbol(name);
-	symbol_table = cons(sym, symbol_table);
+/* get_symbol, for a name already hashed */
+static object *intern(char *name, uint32_t hash, size_t len)
+{
+	object *sym;
+	size_t i;
+
+	for (i = hash & (symbol_table_size - 1); (sym = symbol_table[i]) != NULL; 
+		 i = (i + 1) & (symbol_table_size - 1))
+		if (sym->data.sym.hash == hash && sym->data.sym.len == len 
+		 && !memcmp(sym->data.sym.name, name, len))
+			return sym;
+
+	sym = make_symbol_hashed(name, hash, len);
+	symbol_table[i] = sym;
+	if (++symbol_count * 2 > symbol_table_size) /* keep the load factor under 1/2 */
+		grow_symbol_table();
 	return sym;
 }
 
-object *make_prim_fun(prim_proc fun)
+object *get_symbol(char *name)
+{
+	size_t len;
+	uint32_t hash = hash_string(name, &len);
+
+	return intern(name, hash, len);
+}
+
+object *make_prim_fun(prim_proc fun, char *name)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_prim_fun;
-	obj->data.prim = fun;
+	object *obj = alloc_old(scm_prim_fun);
+	obj->data.prim.fn = fun;
+	obj->data.prim.name = name;
+	return obj;
 }
 prim_proc obj2prim_proc(object *obj)
 {
 	check_type(scm_prim_fun, obj, 1);
-	return obj->data.prim;
+	return obj->data.prim.fn;
 }
 
-object *make_lambda(object *args, object *code, object *env)
+object *make_lambda(object *args, object *code, object *env, int frame_size)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_lambda;
+	object *obj = alloc_obj(scm_lambda);
 	obj->data.lambda.args = args;
 	obj->data.lambda.code = code;
 	obj->data.lambda.env = env;
-	args->refs++;
-	code->refs++;
-	env->refs++;
+	obj->data.lambda.frame_size = frame_size;
+	for (obj->data.lambda.nreq = 0; check_type(scm_pair, args, 0); args = cdr(args))
+		obj->data.lambda.nreq++;
+	obj->data.lambda.rest = args != empty_list;
 	return obj;
 }
 
@@ -299,15 +913,170 @@ object *lambda_env(object *obj)
 	return obj->data.lambda.env;
 }
 
+/* 
+ * A vector is laid out like a frame, its slots straight after the 
+ * header, so it's one block of memory however long it is.
+ */
+object *make_vector(size_t length, object *fill)
+{
+	object *obj;
+	size_t i;
+
+	if (length > INT_MAX)
+		eval_err("Vector too long:", make_integer(length));
+	obj = alloc_slots(scm_vector, length);
+	obj->data.frame.parent = NULL;
+	for (i = 0; i < length; i++)
+		FRAME_SLOTS(obj)[i] = fill;
+	return obj;
+}
+
+size_t vector_length(object *obj)
+{
+	check_type(scm_vector, obj, 1);
+	return obj->data.frame.size;
+}
+
+object **vector_slots(object *obj)
+{
+	check_type(scm_vector, obj, 1);
+	return FRAME_SLOTS(obj);
+}
+
+static size_t vector_index(object *obj, object *index)
+{
+	intptr_t k = obj2int(index);
+	check_type(scm_vector, obj, 1);
+	if (k < 0 || k >= obj->data.frame.size)
+		eval_err("Index out of range:", index);
+	return k;
+}
+
+object *vector_ref(object *obj, object *index)
+{
+	return FRAME_SLOTS(obj)[vector_index(obj, index)];
+}
+
+void vector_set(object *obj, object *index, object *value)
+{
+	size_t k = vector_index(obj, index);
+	write_barrier(obj, value);
+	FRAME_SLOTS(obj)[k] = value;
+}
+
+void vector_fill(object *obj, object *fill, size_t start, size_t end)
+{
+	check_type(scm_vector, obj, 1);
+	if (end > obj->data.frame.size || start > end)
+		eval_err("Index out of range:", make_integer(end > obj->data.frame.size ? end : start));
+	write_barrier(obj, fill);
+	while (start < end)
+		FRAME_SLOTS(obj)[start++] = fill;
+}
+
+object *list_to_vector(object *list)
+{
+	object *obj, *rest;
+	size_t length = 0, i;
+
+	for (rest = list; rest != empty_list; rest = cdr(rest))
+		length++;
+	obj = make_vector(length, false);
+	for (i = 0; i < length; i++, list = list->data.pair.cdr)
+		FRAME_SLOTS(obj)[i] = list->data.pair.car;
+	return obj;
+}
+
+/* nothing is collected while consing, so the list needn't be protected */
+object *vector_to_list(object *obj, size_t start, size_t end)
+{
+	object *list = empty_list;
+	check_type(scm_vector, obj, 1);
+	if (end > obj->data.frame.size || start > end)
+		eval_err("Index out of range:", make_integer(end > obj->data.frame.size ? end : start));
+	while (end > start)
+		list = cons(FRAME_SLOTS(obj)[--end], list);
+	return list;
+}
+
+object *make_bytevector(size_t length, int fill)
+{
+	object *obj = alloc_old(scm_bytevector);
+	obj->data.bytevector.bytes = malloc(length ? length : 1);
+	if (obj->data.bytevector.bytes == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	memset(obj->data.bytevector.bytes, fill, length);
+	obj->data.bytevector.length = length;
+	return obj;
+}
+
+int obj2byte(object *obj)
+{
+	if (!is_fixnum(obj) || obj2int(obj) < 0 || obj2int(obj) > 255)
+		eval_err("Not a byte:", obj);
+	return obj2int(obj);
+}
+
+size_t bytevector_length(object *obj)
+{
+	check_type(scm_bytevector, obj, 1);
+	return obj->data.bytevector.length;
+}
+
+unsigned char *bytevector_bytes(object *obj)
+{
+	check_type(scm_bytevector, obj, 1);
+	return obj->data.bytevector.bytes;
+}
+
+object *list_to_bytevector(object *list)
+{
+	object *obj, *rest;
+	size_t length = 0, i;
+
+	for (rest = list; rest != empty_list; rest = cdr(rest))
+		length++;
+	obj = make_bytevector(length, 0);
+	for (i = 0; i < length; i++, list = list->data.pair.cdr)
+		obj->data.bytevector.bytes[i] = obj2byte(list->data.pair.car);
+	return obj;
+}
+
 object *make_port(FILE *handle, int direction)
 {
-	object *obj = alloc_obj();
-	obj->type = scm_file;
+	object *obj = alloc_old(scm_file);
 	obj->data.port.handle = handle;
 	obj->data.port.direction = direction;
+	obj->data.port.in = direction && handle != NULL ? open_source(handle) : NULL;
+	obj->data.port.string = NULL;
+	obj->data.port.length = 0;
 	return obj;
 }
 
+object *make_string_port(void)
+{
+	object *obj = make_port(NULL, 0);
+	obj->data.port.handle = open_memstream(&obj->data.port.string, &obj->data.port.length);
+	if (obj->data.port.handle == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return obj;
+}
+
+/* the string port's buffer stays until it's collected, closing it or not */
+object *string_port_contents(object *obj)
+{
+	check_type(scm_file, obj, 1);
+	if (obj->data.port.handle != NULL && !obj->data.port.direction)
+		fflush(obj->data.port.handle); /* brings string and length up to date */
+	if (obj->data.port.string == NULL)
+		eval_err("Not a string port:", obj);
+	return make_str_len(obj->data.port.string, obj->data.port.length);
+}
+
 /*1 is input, 0 is output*/
 int port_direction(object *obj)
 {
@@ -321,27 +1090,50 @@ FILE *port_handle(object *obj)
 	return obj->data.port.handle;
 }
 
-void set_port_handle_to_null(object *obj) /*can you guess what it does? */
+source *port_source(object *obj)
 {
 	check_type(scm_file, obj, 1);
-	obj->data.port.handle = NULL; /*here's a hint!*/
+	return obj->data.port.in;
 }
 
-static void init_constants(void)
+void set_port_handle_to_null(object *obj) /*can you guess what it does? */
 {
-	true = alloc_obj();
-	true->type = scm_bool;
-
-	false = alloc_obj();
-	false->type = scm_bool;
+	check_type(scm_file, obj, 1);
+	obj->data.port.handle = NULL; /*here's a hint!*/
+	obj->data.port.in = NULL;
+}
 
-	empty_list = alloc_obj();
-	empty_list->type = scm_empty_list;
+static object *quote_symbol, *begin_symbol, *ok_symbol;
+static void init_char_classes(void);
 
-	eof = alloc_obj();
-	eof->type = scm_eof;
+static void init_syntax(void)
+{
+#define SYNTAX(name, tag) get_symbol(name)->data.sym.syntax = tag
+	SYNTAX("QUOTE", syn_quote);
+	SYNTAX("DEFINE", syn_define);
+	SYNTAX("SET!", syn_set);
+	SYNTAX("IF", syn_if);
+	SYNTAX("LAMBDA", syn_lambda);
+	SYNTAX("BEGIN", syn_begin);
+	SYNTAX("COND", syn_cond);
+	SYNTAX("LET", syn_let);
+	SYNTAX("AND", syn_and);
+	SYNTAX("OR", syn_or);
+	SYNTAX("DECLARE", syn_declare);
+#undef SYNTAX
+
+	quote_symbol = get_symbol("QUOTE");
+	begin_symbol = get_symbol("BEGIN");
+	ok_symbol = get_symbol("OK");
+}
 
-	symbol_table = empty_list;
+void init_constants(void)
+{
+	init_heap();
+	grow_symbol_table();
+	init_syntax();
+	init_char_classes();
+	stdin_source = open_source(stdin);
 
 	global_enviroment = cons(empty_list, empty_list);
 }
@@ -350,47 +1142,142 @@ static void init_constants(void)
  * Read
  */
 
-int is_delimiter(int c) /*int not char because it might be EOF */
+/*
+ * The reader scans a source's buffer directly (see util.h), so most
+ * characters cost a compare and an increment. Tokens are gathered in a
+ * buffer that grows as needed, so they can be any length.
+ */
+
+source *stdin_source;
+
+static char *token;
+static size_t token_size;
+
+static void read_err(source *in, char *fmt, ...) __attribute__((noreturn));
+static void read_err(source *in, char *fmt, ...)
 {
-	return isspace(c) || c == EOF ||
-		   c == '('   || c == ')' ||
-		   c == '"'   || c == ';' ||
-		   c == '\'';
+	va_list ap;
+	long line, column;
+
+	source_position(in, &line, &column);
+	fprintf(stderr, "Read error at line %ld, column %ld: ", line, column);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
 }
 
+/* makes room for the len'th character of the token */
+static inline void token_room(size_t len)
+{
+	if (len < token_size)
+		return;
+	token_size = token_size ? token_size * 2 : 256;
+	if ((token = realloc(token, token_size)) == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+}
 
+/* what each character is to the reader, indexed by c + 1 so EOF is 0 */
+#define CH_SPACE 1
+#define CH_DELIMITER 2
+static unsigned char char_classes[257];
 
-static void expect_delim(FILE *in)
+static void init_char_classes(void)
 {
-	if(!is_delimiter(peek(in))){
-		fprintf(stderr, "Unexpected character: expecting a delimiter, got %c.\n", peek(in));
-		exit(1);
+	int c;
+
+	char_classes[0] = CH_DELIMITER;
+	for (c = 0; c < 256; c++){
+		if (isspace(c))
+			char_classes[c + 1] = CH_SPACE | CH_DELIMITER;
+		else if (strchr("()\";'", c) != NULL && c != '\0')
+			char_classes[c + 1] = CH_DELIMITER;
+	}
+}
+
+static inline int is_space(int c)
+{
+	return char_classes[c + 1] & CH_SPACE;
+}
+
+static inline int is_delimiter(int c) /*int not char because it might be EOF */
+{
+	return char_classes[c + 1] & CH_DELIMITER;
+}
+
+static inline int is_digit(int c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static void skip_ws(source *in)
+{
+	unsigned char *nl;
+
+	for (;;){
+		while (in->pos < in->end && is_space(in->buf[in->pos]))
+			in->pos++;
+		if (in->pos == in->end){
+			if (!refill_source(in))
+				return;
+		} else if (in->buf[in->pos] == ';'){
+			while ((nl = memchr(in->buf + in->pos, '\n', in->end - in->pos)) == NULL)
+				if (!refill_source(in))
+					return;
+			in->pos = nl - in->buf;
+		} else return;
+	}
+}
+
+/* skips whitespace and comments */
+static inline void eat_ws(source *in)
+{
+	if (in->pos < in->end && !is_space(in->buf[in->pos]) && in->buf[in->pos] != ';')
+		return;
+	skip_ws(in);
+}
+
+static void eat_expected_str(source *in, char *str)
+{
+	int c;
+
+	while(*str != '\0'){
+		c = source_getc(in);
+		if(c != *str++)
+			read_err(in, "Unexpected character: expecting %s, got %c.\n", str - 1, c);
 	}
 }
 
-static object *read_char(FILE *in) 
+static void expect_delim(source *in)
+{
+	if(!is_delimiter(source_peek(in)))
+		read_err(in, "Unexpected character: expecting a delimiter, got %c.\n", source_peek(in));
+}
+
+static object *read_char(source *in) 
 {
     int c;
 
-    c = getc(in);
+    c = source_getc(in);
     switch (c) {
     case EOF:
-        fprintf(stderr, "Unexpected end of file: Incomplete character literal.\n");
-        exit(1);
+        read_err(in, "Unexpected end of file: Incomplete character literal.\n");
     case 's':
-        if (peek(in) == 'p') {
+        if (source_peek(in) == 'p') {
             eat_expected_str(in, "pace");
             c = ' ';
         }
         break;
     case 'n':
-        if (peek(in) == 'e') {
+        if (source_peek(in) == 'e') {
             eat_expected_str(in, "ewline");
             c = '\n';
         }
         break;
     case 't':
-    	if (peek(in) == 'a'){
+    	if (source_peek(in) == 'a'){
     		eat_expected_str(in, "ab");
     		c = '\t';
     	}
@@ -400,389 +1287,912 @@ static object *read_char(FILE *in)
     return make_char(c);
 }
 
-static object *read_list(FILE *in){
-	object *car, *cdr;
+/* reads the rest of a list, after the ( */
+static object *read_list(source *in){
+	object *list, *last, *next;
 	int c;
 	eat_ws(in);
 
-	c = getc(in);
-	if (c == ')') 
+	c = source_peek(in);
+	if (c == ')'){
+		in->pos++;
 		return empty_list;
-	if (c == EOF){
-		fprintf(stderr, "Unexpected end of file: unclosed list.\n");
-		exit(1);
 	}
-	ungetc(c, in);
-
-	car = read(in);
-	eat_ws(in);
-
-	if(peek(in) == '.'){ /* improper list */
-		getc(in);
-		if(!is_delimiter(c = peek(in))){
-			fprintf(stderr, "Bad list: expecting delimiter after dot, got %c.\n", c);
-			exit(1);
-		}
-		cdr = read(in);
+	if (c == EOF)
+		read_err(in, "Unexpected end of file: unclosed list.\n");
 
+	/* nothing is collected while reading, so list needn't be protected */
+	list = last = cons(read_datum(in), empty_list);
+	for (;;){
 		eat_ws(in);
-		if (c = getc(in) != ')'){
-			fprintf(stderr, "Bad list: expecting ), got %c.\n", c);
-			exit(1);
+		c = source_peek(in);
+		if (c == ')'){
+			in->pos++;
+			return list;
 		}
+		if (c == EOF)
+			read_err(in, "Unexpected end of file: unclosed list.\n");
+		if (c == '.'){ /* improper list, unless it's .5 or ... */
+			in->pos++;
+			if (is_delimiter(source_peek(in))){
+				set_cdr(last, read_datum(in));
+
+				eat_ws(in);
+				if ((c = source_getc(in)) != ')')
+					read_err(in, "Bad list: expecting ), got %c.\n", c);
+				return list;
+			}
+			unget_source(in, '.');
+		}
+		next = cons(read_datum(in), empty_list);
+		write_barrier(last, next);
+		last->data.pair.cdr = next;
+		last = next;
 	}
-	else cdr = read_list(in);
-
-	return cons(car, cdr);
 }
 
-#define BUF_MAX 1024
-object *read(FILE *in)
+object *read_datum(source *in)
 {
 	int c; 
+	size_t len;
 
 	eat_ws(in);
 
-	c = getc(in);
+	c = source_getc(in);
 
 	if (c == EOF) return eof;
-	else if (isdigit(c) || (c == '-' && isdigit(peek(in))))
+	else if (is_digit(c))
 	{
-		/* read an integer */
-		int sign = 1, num = 0;
-		if (c == '-')
-			sign = -1;
-		else 
-			ungetc(c, in);
-		
-
-		while (isdigit(c = getc(in)))
-			num = (num * 10) + (int)c - '0';
-
-		num *= sign;
-
-		if (!is_delimiter(c)) {
-			fprintf(stderr, "Expecting delimiter after number, got %c.\n", c);
-			exit(1);
-		}
-
-		ungetc(c, in);
-		return make_int(num);
+		/* read a number; ones starting with a sign or . are read as symbols first */
+		object *num;
+		len = 0;
+		do {
+			token_room(len);
+			token[len++] = c;
+		} while (!is_delimiter(c = source_getc(in)));
+		unget_source(in, c);
+		token_room(len);
+		token[len] = '\0';
+		if ((num = string_to_number(token, 10)) == NULL)
+			read_err(in, "Bad number %s.\n", token);
+		return num;
 	}
 	else if (c == '#'){
 		/* read boolean or character */
-		switch(c = getc(in)){
+		switch(c = source_getc(in)){
 		case 't':
 			return true;
 		case 'f':
 			return false;
 		case '\\':
 			return read_char(in);
+		case '(':
+			return list_to_vector(read_list(in));
+		case 'u':
+			eat_expected_str(in, "8(");
+			return list_to_bytevector(read_list(in));
 		case '<':
-			fprintf(stderr, "Unreadable object in input stream.\n");
-			exit(1);
+			read_err(in, "Unreadable object in input stream.\n");
 		default:
-			fprintf(stderr, "Bad input. Expecting t, f, or \\, got %c.\n", c);
-			exit(1);
+			read_err(in, "Bad input. Expecting t, f, \\, ( or u8(, got %c.\n", c);
 		}
 	}
 	else if (c == '"')
 	{
 		/* read a string */
-		char buf[BUF_MAX];
-		int len = 0;
+		len = 0;
+		while ((c = source_getc(in)) != '"'){
+			if (c == EOF)
+				read_err(in, "Unexpected end of file: Non terminated string literal.\n");
+
+			if (c == '\\'){
+				c = source_getc(in);
+				if (c == 'n') c = '\n';
+				if (c == 't') c = '\t';
+			}
+
+			token_room(len);
+			token[len++] = c;
+		}
+		return make_str_len(token, len);
+	}
+	else if (c == '('){
+		/* read a list */
+		return read_list(in);
+	}
+	else if (c == '\''){
+		/* quote */
+		return cons(quote_symbol, 
+			cons(read_datum(in), empty_list));
+	}
+
+	else if (!is_delimiter(c)) {
+		/*read a symbol, hashing it as it goes*/
+		uint32_t hash = HASH_START;
+		object *num;
+		len = 0;
+		in->pos--;
+		for (;;){
+			while (in->pos < in->end && !is_delimiter(c = in->buf[in->pos])){
+				if (c >= 'a' && c <= 'z')
+					c += 'A' - 'a';
+				token_room(len);
+				token[len++] = c;
+				hash = HASH_STEP(hash, c);
+				in->pos++;
+			}
+			if (in->pos < in->end || !refill_source(in))
+				break;
+		}
+		token_room(len);
+		token[len] = '\0';
+		if ((token[0] == '-' || token[0] == '+' || token[0] == '.') && len > 1
+			&& (num = string_to_number(token, 10)) != NULL)
+			return num;
+		return intern(token, hash, len);
+	}
+
+	else
+		read_err(in, "Bad input: Unexpected %c.\n", c);
+}
+
+
+/*
+ * Eval - based on SICP
+ */
+
+void eval_err(char *msg, object *code)
+{
+	fprintf(stderr, "Evaluation error: %s ", msg);
+	print(stderr, code, 0);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+/* 
+ * returns 1 if code's length is between min and max inclusive, 0 otherwise 
+ * min or max of -1 indicate no minimum/maximum 
+ */
+static int check_length_between(int min, int max, object *code){
+	while(1){
+		if (min < 0 && max < 0) return 1;
+		if (code == empty_list && min <= 0) return 1;
+
+		if(max == 0) return 0;
+		if(!check_type(scm_pair, code, 0)) return 0;
+
+		code = cdr(code);
+		--min;
+		--max;
+	}
+}
+
+/*
+ * Enviroments. The global enviroment keeps the value of each variable
+ * in the variable's symbol. Other top level enviroments (made by the
+ * enviroment procedures) are lists of frames of (var . val) bindings.
+ * The enviroment of a procedure call is a frame object 
+ * instead: a slot for each parameter and internal definition, and a 
+ * link to the enviroment the procedure was made in. Analysis works out
+ * the slot of each local variable, so locals are found by position 
+ * rather than by name.
+ */
+
+static inline void set_global(object *var, object *val)
+{
+	write_barrier(var, val);
+	var->data.sym.value = val;
+}
+
+static inline object *get_global(object *var)
+{
+	if(var->data.sym.value == NULL)
+		eval_err("unbound variable", var);
+	return var->data.sym.value;
+}
+
+void define_var(object *var, object *val, object *env)
+{
+	if(env == global_enviroment)
+		set_global(var, val);
+	else
+		set_car(env, cons(cons(var, val), car(env)));
+}
+
+static object *find_var_binding(object *var, object *env)
+{
+	object *frame;
+	for(; env != empty_list; env = cdr(env))
+		for(frame = car(env); frame != empty_list; frame = cdr(frame))
+			if(caar(frame) == var)
+				return car(frame);
+	eval_err("unbound variable", var);
+}
+
+void set_var(object *var, object *val, object *env)
+{
+	if(env == global_enviroment){
+		get_global(var); /* must already be bound */
+		set_global(var, val);
+	} else
+		set_cdr(find_var_binding(var, env), val); /* set_cdr has the write barrier */
+}
+
+object *get_var(object *var, object *env)
+{
+	if(env == global_enviroment)
+		return get_global(var);
+	return cdr(find_var_binding(var, env));
+}
+
+/* a frame for a call to proc, with every slot unassigned (NULL) */
+static object *make_frame(object *proc)
+{
+	int size = proc->data.lambda.frame_size;
+	object *frame = alloc_frame(size);
+	frame->data.frame.parent = proc->data.lambda.env;
+	write_barrier(frame, frame->data.frame.parent);
+	memset(FRAME_SLOTS(frame), 0, size * sizeof(object *));
+	return frame;
+}
+
+/* 
+ * Checks the argument count once the first count arguments are in 
+ * frame, and binds the rest argument to the list of any others.
+ */
+static void finish_frame(object *proc, object *frame, int count, object *others)
+{
+	object *vars;
+	if(count < proc->data.lambda.nreq){
+		for(vars = lambda_args(proc); count > 0; count--)
+			vars = cdr(vars);
+		eval_err("Not enough arguments to a function, these variables had no value:", vars);
+	}
+	if(proc->data.lambda.rest)
+		frame_set(frame, count, others);
+	else if(others != empty_list)
+		eval_err("Too many arguments to a function, excessive arguments are:", others);
+}
+
+static object *bind_args(object *proc, object *args)
+{
+	object *frame = make_frame(proc);
+	int i;
+	for(i = 0; i < proc->data.lambda.nreq && args != empty_list; i++, args = cdr(args))
+		frame_set(frame, i, car(args));
+	finish_frame(proc, frame, i, args);
+	return frame;
+}
+
+static inline object *outer_frame(object *frame, int depth)
+{
+	while(depth--)
+		frame = frame->data.frame.parent;
+	return frame;
+}
+
+static inline enum syntax syntax_of(object *head)
+{
+	return check_type(scm_symbol, head, 0) ? head->data.sym.syntax : not_syntax;
+}
+
+static int self_evaluating(object *code)
+{
+#define check(x) check_type(scm_ ## x, code, 0)
+ 	return check(int) || check(str) || check(char) || check(eof) || check(bool)
+		|| check(bignum) || check(flonum) || check(vector) || check(bytevector);
+#undef check
+}
+
+object *maybe_add_begin(object *code)
+{
+	if (cdr(code) == empty_list) return car(code);
+	return cons(begin_symbol, code);
+}
+
+/*
+ * Analysis: code is checked and turned into a tree of nodes once, and 
+ * then the tree is executed as many times as needed (SICP 4.1.7), by
+ * the register machine in run. Each node's op says what it is and its
+ * three fields hold what that needs.
+ *
+ * Nodes are allocated old so they never move, and the machine can hold
+ * them in C variables and on its stack without them being updated. 
+ * Analysis never runs code, so it can't trigger a collection.
+ */
 
-		while ((c = getc(in)) != '"'){
-			if (c == EOF){
-				fprintf(stderr, "Unexpected end of file: Non terminated string literal.\n");
-				exit(1);
-			}
+/* 
+ * The enviroment code is analyzed in: the variables of each enclosing 
+ * frame, innermost first, down to the top level enviroment.
+ */
+struct scope {
+	struct scope *outer; /* NULL at the top level */
+	object *vars;        /* the frame's variables in slot order, or the top level enviroment */
+};
 
-			if (c == '\\'){
-				c = getc(in);
-				if (c == 'n') c = '\n';
-				if (c == 't') c = '\t';
-			}
+static object *analyze(object *code, struct scope *scope);
 
-			buf[len++] = c;
-			if (len == BUF_MAX){
-				fprintf(stderr, "String too long. Maximum length is %d.\n", BUF_MAX);
-				exit(1);
-			}
-		}
-		buf[len] = '\0';
-		return make_str(buf);
-	}
-	else if (c == '('){
-		/* read a list */
-		return read_list(in);
-	}
-	else if (c == '\''){
-		/* quote */
-		return cons(get_symbol("QUOTE"), 
-			cons(read(in), empty_list));
-	}
+static object *make_node(enum node_op op, object *a, object *b, object *c)
+{
+	object *obj = alloc_old(scm_node);
+	obj->data.node.op = op;
+	obj->data.node.a = a;
+	obj->data.node.b = b;
+	obj->data.node.c = c;
+	write_barrier(obj, a);
+	write_barrier(obj, b);
+	write_barrier(obj, c);
+	return obj;
+}
 
-	else if (!is_delimiter(c)) {
-		/*read a symbol*/
-		char buf[BUF_MAX];
-		int len = 0;
-		ungetc(c, in);
-
-		while(!is_delimiter(c = getc(in))){
-			buf[len++] = toupper(c);
-			if (len == BUF_MAX) {
-				fprintf(stderr, "Symbol too long. Makimum length is %d.\n", BUF_MAX);
-				exit(1);
-			}
-		}
-		ungetc(c, in);
-		buf[len] = '\0';
-		return get_symbol(buf);
-	}
+#define NODE_A (node->data.node.a)
+#define NODE_B (node->data.node.b)
+#define NODE_C (node->data.node.c)
 
-	else {
-		fprintf(stderr, "Bad input: Unexpected %c.\n", c);
+/*
+ * The evaluator is a register machine (SICP 5.4) running the nodes:
+ * node and env say what to evaluate next and where, and the result goes
+ * in val. Whatever has to happen once a subexpression's value is known
+ * is pushed on the stack as a label from enum continuation, on top of
+ * the registers it needs back; returning a value pops the label and
+ * carries on from there. The arguments of a call are pushed on the
+ * stack too, above the procedure, and copied into its frame once they
+ * are all there. So evaluating never recurses in C, and a call in tail
+ * position pushes nothing, as nothing is left to do after it.
+ *
+ * The stack is malloced, grows as it fills, and is a root for the
+ * collector. It can't grow past eval_stack_limit words, so runaway
+ * recursion is an error rather than a crash. A primitive can call eval
+ * again (load does), which runs the machine on the same stack above
+ * what's already there; that's why the stack's position is kept in
+ * eval_sp, and indices rather than pointers into it are held in C
+ * variables across anything that might grow it.
+ *
+ * Variables, constants and lambdas can't call anything, so when one is
+ * an operand, a test or the operator of a call, it's evaluated on the
+ * spot by simple_value instead of going round the machine.
+ *
+ * The vm and compiled programs set apply_closure to call their own
+ * closures, so a procedure made by load can be handed one of those, and
+ * they call apply for a lambda in return. Either way round the call 
+ * nests in C.
+ */
+size_t eval_stack_limit = EVAL_STACK_LIMIT;
+object *(*apply_closure)(object *proc, object *args);
+
+enum continuation {
+	k_assign,    /* node, env: the node is a set! or define */
+	k_if,        /* node, env */
+	k_sequence,  /* node, env */
+	k_operator,  /* node, env: the node is the call */
+	k_operand    /* the procedure's index on the stack, the operands left, env */
+};
+
+#define PUSH(x) (*eval_sp++ = (x))
+#define POP() (*--eval_sp)
+#define NEED(n) do{ if(eval_sp + (n) > eval_stack_end) grow_eval_stack(n); }while(0)
+
+static void grow_eval_stack(size_t n)
+{
+	size_t used = eval_sp - eval_stack, size = eval_stack_end - eval_stack;
+
+	if(used + n > eval_stack_limit)
+		eval_err("recursion too deep, the stack is full at --stack-limit", make_integer(eval_stack_limit));
+	while(size < used + n)
+		size = size ? 2 * size : 1024;
+	if(size > eval_stack_limit)
+		size = eval_stack_limit;
+	eval_stack = realloc(eval_stack, size * sizeof(object *));
+	if(eval_stack == NULL){
+		fprintf(stderr, "Out of memory.\n");
 		exit(1);
 	}
+	eval_sp = eval_stack + used;
+	eval_stack_end = eval_stack + size;
 }
 
+static inline object *local_value(object *node, object *frame)
+{
+	object *val = FRAME_SLOTS(frame)[obj2int(NODE_B)];
+	if(val == NULL)
+		eval_err("unbound variable", NODE_C);
+	return val;
+}
 
-/*
- * Eval - based on SICP
- */
+/* the value of node if it's a variable, a constant or a lambda, otherwise NULL */
+static inline object *simple_value(object *node, object *env)
+{
+	switch(node->data.node.op){
+	case node_constant:
+		return NODE_A;
+	case node_local0:
+		return local_value(node, env);
+	case node_local:
+		return local_value(node, outer_frame(env, obj2int(NODE_A)));
+	case node_global:
+		return get_var(NODE_A, NODE_B);
+	case node_global_value:
+		return get_global(NODE_A);
+	case node_lambda:
+		return make_lambda(NODE_A, NODE_B, env, obj2int(NODE_C));
+	default:
+		return NULL;
+	}
+}
 
-void eval_err(char *msg, object *code)
+/* a new list of the n objects from args up */
+static object *list_from_stack(object **args, int n)
 {
-	fprintf(stderr, "Evaluation error: %s ", msg);
-	print(stderr, code, 0);
-	fputc('\n', stderr);
-	exit(1);
+	object *list = empty_list;
+	while(n > 0)
+		list = cons(args[--n], list);
+	return list;
 }
 
 /* 
- * returns 1 if code's length is between min and max inclusive, 0 otherwise 
- * min or max of -1 indicate no minimum/maximum 
+ * runs node in env, or applies proc to the list val if node is NULL, 
+ * and returns the value once the stack is back where it started
  */
-static int check_length_between(int min, int max, object *code){
-	while(1){
-		if (min < 0 && max < 0) return 1;
-		if (code == empty_list && min <= 0) return 1;
+static object *run(object *node, object *env, object *proc, object *val)
+{
+	object *unev, *frame;
+	size_t entry = eval_sp - eval_stack, base;
+	int depth = gc_depth(), n, i;
+	struct scope top = {NULL, NULL};
+
+	/* nothing else is live at the safe point */
+	gc_protect(&node);
+	gc_protect(&env);
+	if(node == NULL)
+		goto apply;
+
+eval:
+	gc_safe_point();
+	switch(node->data.node.op){
+	case node_set_local:
+		NEED(3);
+		PUSH(node);
+		PUSH(env);
+		PUSH(make_int(k_assign));
+		node = NODE_C;
+		goto eval;
+
+	case node_define_local:
+	case node_set_global:
+	case node_define_global:
+		NEED(3);
+		PUSH(node);
+		PUSH(env);
+		PUSH(make_int(k_assign));
+		node = NODE_B;
+		goto eval;
+
+	case node_if:
+		if((val = simple_value(NODE_A, env)) == NULL){
+			NEED(3);
+			PUSH(node);
+			PUSH(env);
+			PUSH(make_int(k_if));
+			node = NODE_A;
+			goto eval;
+		}
+		node = is_true(val) ? NODE_B : NODE_C;
+		goto eval;
+
+	case node_sequence:
+		if(simple_value(NODE_A, env) == NULL){
+			NEED(3);
+			PUSH(node);
+			PUSH(env);
+			PUSH(make_int(k_sequence));
+			node = NODE_A;
+			goto eval;
+		}
+		node = NODE_B;
+		goto eval;
+
+	case node_application:
+		if((proc = simple_value(NODE_A, env)) == NULL){
+			NEED(3);
+			PUSH(node);
+			PUSH(env);
+			PUSH(make_int(k_operator));
+			node = NODE_A;
+			goto eval;
+		}
+		unev = NODE_B;
+		goto operands;
 
-		if(max == 0) return 0;
-		if(!check_type(scm_pair, code, 0)) return 0;
+	default:
+		val = simple_value(node, env);
+		goto return_val;
+	}
 
-		code = cdr(code);
-		--min;
-		--max;
+operands: /* proc is the procedure and unev the operands */
+	NEED(1);
+	base = eval_sp - eval_stack;
+	PUSH(proc);
+next_operand:
+	for(; unev != empty_list; unev = unev->data.pair.cdr){
+		if((val = simple_value(unev->data.pair.car, env)) == NULL){
+			NEED(4);
+			PUSH(make_int(base));
+			PUSH(unev);
+			PUSH(env);
+			PUSH(make_int(k_operand));
+			node = unev->data.pair.car;
+			goto eval;
+		}
+		NEED(1);
+		PUSH(val);
+	}
+
+	/* the procedure is at base, with its n arguments above it */
+	proc = eval_stack[base];
+	n = eval_sp - eval_stack - base - 1;
+	if(is_heap_type(proc, scm_lambda)){
+		frame = make_frame(proc);
+		for(i = 0; i < n && i < proc->data.lambda.nreq; i++)
+			FRAME_SLOTS(frame)[i] = eval_stack[base + 1 + i]; /* it's new, so no write barrier */
+		finish_frame(proc, frame, i, list_from_stack(eval_stack + base + 1 + i, n - i));
+		eval_sp = eval_stack + base;
+		env = frame;
+		node = proc->data.lambda.code;
+		goto eval;
+	}
+	val = list_from_stack(eval_stack + base + 1, n);
+	eval_sp = eval_stack + base;
+
+apply: /* proc is applied to the list val */
+	if(is_heap_type(proc, scm_prim_fun)){
+		if(proc->data.prim.fn == apply_proc){ /* apply and eval are done here, so */
+			proc = car(val);                  /* that calls they make are tail    */
+			val = cadr(val);                  /* calls. The implementations in    */
+			goto apply;                       /* prims.c signal an error if they  */
+		}                                     /* are ever called.                 */
+		if(proc->data.prim.fn == eval_proc){
+			top.vars = env = cadr(val);
+			node = analyze(car(val), &top);
+			goto eval;
+		}
+		val = proc->data.prim.fn(val);
+		goto return_val;
 	}
+	if(is_heap_type(proc, scm_closure) && apply_closure != NULL){
+		val = apply_closure(proc, val);
+		goto return_val;
+	}
+	if(!is_heap_type(proc, scm_lambda))
+		eval_err("not a function:", proc);
+	env = bind_args(proc, val);
+	node = proc->data.lambda.code;
+	goto eval;
+
+return_val:
+	if(eval_sp == eval_stack + entry){
+		gc_release(depth);
+		return val;
+	}
+	switch((enum continuation) obj2int(POP())){
+	case k_assign:
+		env = POP();
+		node = POP();
+		switch(node->data.node.op){
+		case node_set_local:
+			frame_set(outer_frame(env, obj2int(NODE_A)), obj2int(NODE_B), val);
+			val = ok_symbol;
+			break;
+		case node_define_local:
+			frame_set(env, obj2int(NODE_A), val);
+			val = NODE_C;
+			break;
+		case node_set_global:
+			set_var(NODE_A, val, NODE_C);
+			val = ok_symbol;
+			break;
+		default:
+			define_var(NODE_A, val, NODE_C);
+			val = NODE_A;
+			break;
+		}
+		goto return_val;
+
+	case k_if:
+		env = POP();
+		node = POP();
+		node = is_true(val) ? NODE_B : NODE_C;
+		goto eval;
+
+	case k_sequence:
+		env = POP();
+		node = POP();
+		node = NODE_B;
+		goto eval;
+
+	case k_operator:
+		env = POP();
+		node = POP();
+		proc = val;
+		unev = NODE_B;
+		goto operands;
+
+	case k_operand:
+		env = POP();
+		unev = POP();
+		base = obj2int(POP());
+		PUSH(val); /* where base + 4 words were */
+		unev = unev->data.pair.cdr;
+		goto next_operand;
+	}
+	fprintf(stderr, "Internal error: a bad continuation on the evaluator's stack.\n");
+	exit(1);
 }
 
-void define_var(object *var, object *val, object *env)
+#undef PUSH
+#undef POP
+#undef NEED
+
+#undef NODE_A
+#undef NODE_B
+#undef NODE_C
+
+/* returns the top level enviroment if var isn't local */
+static object *resolve(object *var, struct scope *scope, int *depth, int *index)
 {
-	set_car(env, cons(cons(var, val), car(env)));
+	object *vars;
+	for(*depth = 0; scope->outer != NULL; scope = scope->outer, ++*depth)
+		for(vars = scope->vars, *index = 0; vars != empty_list; vars = cdr(vars), ++*index)
+			if(car(vars) == var)
+				return NULL;
+	return scope->vars;
 }
 
-static object *find_var_binding(object *var, object *env)
+static int var_index(object *var, object *vars)
 {
-	object *frame;
-	for(; env != empty_list; env = cdr(env))
-		for(frame = car(env); frame != empty_list; frame = cdr(frame))
-			if(caar(frame) == var)
-				return car(frame);
-	eval_err("unbound variable", var);
+	int i;
+	for(i = 0; vars != empty_list; vars = cdr(vars), i++)
+		if(car(vars) == var)
+			return i;
+	return -1;
 }
 
-void set_var(object *var, object *val, object *env)
+static int list_length(object *list)
 {
-	set_cdr(find_var_binding(var, env), val);
+	int i;
+	for(i = 0; list != empty_list; list = cdr(list))
+		i++;
+	return i;
 }
 
-object *get_var(object *var, object *env)
+static object *add_var(object *var, object *vars)
 {
-	return cdr(find_var_binding(var, env));
+	if(vars == empty_list)
+		return cons(var, empty_list);
+	if(car(vars) != var)
+		set_cdr(vars, add_var(var, cdr(vars)));
+	return vars;
 }
 
-static object *make_frame(object *vars, object *vals)
+/* adds the variables of the definitions in a body to vars */
+static object *scan_defines(object *body, object *vars)
 {
-	object *sofar = empty_list;
-	while(vals != empty_list){
-		if (vars == empty_list)
-			eval_err("Too many arguments to a function, excessive arguments are:", vals);
-
-		if(check_type(scm_symbol, vars, 0))
-			return cons(cons(vars, vals), sofar);
-		sofar = cons(cons(car(vars), car(vals)), sofar);
-		vars = cdr(vars);
-		vals = cdr(vals);
+	object *form;
+	for(; check_type(scm_pair, body, 0); body = cdr(body)){
+		form = car(body);
+		if(!check_type(scm_pair, form, 0) || !check_length_between(2, -1, form))
+			continue;
+		switch(syntax_of(car(form))){
+		case syn_define:
+			if(check_type(scm_symbol, cadr(form), 0))
+				vars = add_var(cadr(form), vars);
+			else if(check_type(scm_pair, cadr(form), 0) && check_type(scm_symbol, caadr(form), 0))
+				vars = add_var(caadr(form), vars);
+			break;
+		case syn_begin:
+			vars = scan_defines(cdr(form), vars);
+			break;
+		default:
+			break;
+		}
 	}
-	if(vars != empty_list)
-		eval_err("Not enough arguments to a function, these variables had no value:", vars);
+	return vars;
+}
 
-	return sofar;
+static object *analyze_variable(object *var, struct scope *scope)
+{
+	int depth, index;
+	object *top = resolve(var, scope, &depth, &index);
+
+	if(top == global_enviroment)
+		return make_node(node_global_value, var, NULL, NULL);
+	if(top != NULL)
+		return make_node(node_global, var, top, NULL);
+	return make_node(depth == 0 ? node_local0 : node_local, make_int(depth), make_int(index), var);
 }
 
-object *extend_enviroment(object *vars, object *vals, object *env)
+static object *analyze_sequence(object *exprs, struct scope *scope)
 {
-	return cons(make_frame(vars, vals), env);
+	if(cdr(exprs) == empty_list)
+		return analyze(car(exprs), scope);
+	return make_node(node_sequence, analyze(car(exprs), scope), analyze_sequence(cdr(exprs), scope), NULL);
 }
 
-static int self_evaluating(object *code)
+static object *analyze_lambda(object *params, object *body, struct scope *outer)
 {
-#define check(x) check_type(scm_ ## x, code, 0)
- 	return check(int) || check(str) || check(char) || check(eof) || check(bool);
-#undef check
+	struct scope scope;
+	object *vars = empty_list, *p;
+
+	for(p = params; ; p = cdr(p)){
+		if(p == empty_list)
+			break;
+		if(check_type(scm_pair, p, 0) && check_type(scm_symbol, car(p), 0) 
+		 && var_index(car(p), vars) < 0){
+			vars = add_var(car(p), vars);
+			continue;
+		}
+		if(check_type(scm_symbol, p, 0) && var_index(p, vars) < 0){ /* rest argument */
+			vars = add_var(p, vars);
+			break;
+		}
+		eval_err("bad parameter list:", params);
+	}
+
+	scope.outer = outer;
+	scope.vars = scan_defines(body, vars);
+	return make_node(node_lambda, params, analyze_sequence(body, &scope), 
+		make_int(list_length(scope.vars)));
 }
 
-object *maybe_add_begin(object *code)
+static object *analyze_definition(object *var, object *value, object *code, struct scope *scope)
 {
-	if (cdr(code) == empty_list) return car(code);
-	return cons(get_symbol("BEGIN"), code);
+	int index;
+	if(scope->outer == NULL)
+		return make_node(node_define_global, var, value, scope->vars);
+
+	/* internal definitions were given slots by scan_defines */
+	if((index = var_index(var, scope->vars)) < 0)
+		eval_err("DEFINE in a bad place:", code);
+	return make_node(node_define_local, make_int(index), value, var);
 }
 
-static object *eval_define(object *code, object *env)
+static object *analyze_define(object *code, struct scope *scope)
 {
 	if (!check_length_between(2, -1, code))
-			eval_err("bad DEFINE form:", code);
+		eval_err("bad DEFINE form:", code);
 
 	if(check_type(scm_symbol, cadr(code), 0)) {
 		if(!check_length_between(2, 3, code))
 			eval_err("bad DEFINE form:", code);
 
-		define_var(cadr(code), 
-			(cddr(code) == empty_list ? false : eval(caddr(code), env)), env);
-		return cadr(code);
+		return analyze_definition(cadr(code), 
+			cddr(code) == empty_list ? make_node(node_constant, false, NULL, NULL) 
+			                         : analyze(caddr(code), scope), 
+			code, scope);
 	} 
 		
 	if(check_type(scm_pair, cadr(code), 0)){
 		if(!check_length_between(3, -1, code)) 
 			eval_err("bad DEFINE form:", code);
 
-		define_var(caadr(code), make_lambda(cdadr(code), maybe_add_begin(cddr(code)), env), env);
-		return caadr(code);
+		return analyze_definition(caadr(code), analyze_lambda(cdadr(code), cddr(code), scope), code, scope);
 	}
 
 	eval_err("bad DEFINE form:", code);
 }
 
-static object *eval_each(object *exprs, object *env)
+static object *analyze_set(object *code, struct scope *scope)
 {
-	if(exprs == empty_list)
-		return empty_list;
-	else
-		return cons(eval(car(exprs), env), eval_each(cdr(exprs), env));
-}
+	int depth, index;
+	object *top, *value;
 
+	if(!check_length_between(3, 3, code) || !check_type(scm_symbol, cadr(code), 0))
+		eval_err("bad SET! form:", code);
 
+	value = analyze(caddr(code), scope);
+	top = resolve(cadr(code), scope, &depth, &index);
+	if(top != NULL)
+		return make_node(node_set_global, cadr(code), value, top);
+	return make_node(node_set_local, make_int(depth), make_int(index), value);
+}
 
-object *eval(object *code, object *env)
+static object *analyze_operands(object *exprs, struct scope *scope)
 {
-#define starts_with(s) (car(code) == get_symbol(#s))
+	if(exprs == empty_list)
+		return empty_list;
+	return cons(analyze(car(exprs), scope), analyze_operands(cdr(exprs), scope));
+}
 
-tailcall:
-#define tail(x) do{code = (x); goto tailcall;} while(0)
+/* 
+ * Overwrites a derived form with (BEGIN expansion), so that analyzing 
+ * the same list structure again (eval of a stored form, say) doesn't
+ * expand it again.
+ */
+static object *displace(object *form, object *expansion)
+{
+	set_car(form, begin_symbol);
+	set_cdr(form, cons(expansion, empty_list));
+	return expansion;
+}
 
+static object *analyze(object *code, struct scope *scope)
+{
 	if(self_evaluating(code))
-		return code;
-	else if(check_type(scm_symbol, code, 0))
-		return get_var(code, env);
-
-	else if(check_type(scm_pair, code, 0)){
-
-
-		if starts_with(QUOTE){
-			if (!check_length_between(2, 2, code))
-				eval_err("bad QUOTE form:", code);
+		return make_node(node_constant, code, NULL, NULL);
+	if(check_type(scm_symbol, code, 0))
+		return analyze_variable(code, scope);
+	if(!check_type(scm_pair, code, 0))
+		eval_err("can't evaluate", code);
 
-			return cadr(code);
-		}
-
-		else if starts_with(DEFINE)
-			return eval_define(code, env);
+	switch(syntax_of(car(code))){
+	case syn_quote:
+		if (!check_length_between(2, 2, code))
+			eval_err("bad QUOTE form:", code);
 
-		else if starts_with(SET!){
-			if(!check_length_between(3, 3, code) || !check_type(scm_symbol, cadr(code), 0))
-				eval_err("bad SET! form:", code);
-
-			set_var(cadr(code), eval(caddr(code), env), env);
-			return get_symbol("OK");
-		}
+		return make_node(node_constant, cadr(code), NULL, NULL);
 
-		else if starts_with(IF){
-			if(!check_length_between(3, 4, code))
-				eval_err("bad IF form:", code);
+	case syn_define:
+		return analyze_define(code, scope);
 
-			tail(
-				is_true(eval(cadr(code), env)) ? caddr(code) : /* cond in C! */
-				cdddr(code) == empty_list      ? false       : /*undefined when no else branch*/
-				/* else */   cadddr(code));
-		}
+	case syn_set:
+		return analyze_set(code, scope);
 
-		else if starts_with(LAMBDA){
-			if(!check_length_between(3, -1, code)) 
-				eval_err("bad LAMBDA form:", code);
+	case syn_if:
+		if(!check_length_between(3, 4, code))
+			eval_err("bad IF form:", code);
 
-			return make_lambda(cadr(code), maybe_add_begin(cddr(code)), env);
-		}
+		return make_node(node_if, analyze(cadr(code), scope), analyze(caddr(code), scope),
+			cdddr(code) == empty_list ? make_node(node_constant, false, NULL, NULL) /*undefined when no else branch*/
+			                          : analyze(cadddr(code), scope));
 
-		else if starts_with(BEGIN){
-			if(!check_length_between(2, -1, code)) 
-				eval_err("bad BEGIN form:", code);
+	case syn_lambda:
+		if(!check_length_between(3, -1, code)) 
+			eval_err("bad LAMBDA form:", code);
 
-			for(code = cdr(code); cdr(code) != empty_list; code = cdr(code))
-				eval(car(code), env);
+		return analyze_lambda(cadr(code), cddr(code), scope);
 
-			tail(car(code));
-		}
+	case syn_begin:
+		if(!check_length_between(2, -1, code)) 
+			eval_err("bad BEGIN form:", code);
 
-		/*syntaxes*/
+		return analyze_sequence(cdr(code), scope);
 
-		else if starts_with(COND)
-			tail(cond2nested_if(code));
+	/*syntaxes*/
 
-		else if starts_with(LET)
-			tail(let2lambda(code));
+	case syn_cond:
+		return analyze(displace(code, cond2nested_if(code)), scope);
 
-		else if starts_with(AND)
-			tail(and2nested_if(code));
+	case syn_let:
+		return analyze(displace(code, let2lambda(code)), scope);
 
-		else if starts_with(OR)
-			tail(or2nested_if(code));
+	case syn_and:
+		return analyze(displace(code, and2nested_if(code)), scope);
 
-		else if starts_with(DECLARE)
-			return false;
+	case syn_or:
+		return analyze(displace(code, or2nested_if(code)), scope);
 
+	case syn_declare:
+		return make_node(node_constant, false, NULL, NULL);
 
-		/*more stuff can go here*/
 
-		else{	
-			/*it's a call*/
-			object *proc = eval(car(code), env);
-			object *args = eval_each(cdr(code), env);
-apply:
-			if(check_type(scm_prim_fun, proc, 0)){
-				if(obj2prim_proc(proc) == apply_proc){/*apply should never be called    */
-					proc = car(args);                 /*directly because of tail call   */
-					args = cadr(args);                /*requirements. The implementation*/
-					goto apply;                       /*in prims.c signals an           */
-				}                                     /*error if it is.                 */
+	/*more stuff can go here*/
 
-				if(obj2prim_proc(proc) == eval_proc){ /*same with eval*/
-					env = cadr(args);
-					tail(car(args));
-				}
-				
-				return (obj2prim_proc(proc))(args);
-			}
-			if(!check_type(scm_lambda, proc, 0))
-				eval_err("not a function:", proc);
-	
-			env = extend_enviroment(lambda_args(proc), args, lambda_env(proc));
-			tail(lambda_code(proc));
-		}
+	default:
+		/*it's a call*/
+		return make_node(node_application, analyze(car(code), scope), analyze_operands(cdr(code), scope), NULL);
 	}
+}
+
+/* env must be a top level enviroment */
+object *eval(object *code, object *env)
+{
+	struct scope top = {NULL, env};
+	return run(analyze(code, &top), env, NULL, NULL);
+}
 
-	else eval_err("can't evaluate", code);
+/* calls proc with the list args */
+object *apply(object *proc, object *args)
+{
+	return run(NULL, NULL, proc, args);
 }
 
 /*
@@ -811,10 +2221,18 @@ static void print_list(FILE *out, object *list, int display)
 
 void print(FILE *out, object *obj, int display)
 {
-	switch(obj->type) {
+	switch(type_of(obj)) {
 	case scm_int:
-		fprintf(out, "%d", obj2int(obj));
+		fprintf(out, "%ld", (long) obj2int(obj));
+		break;
+
+	case scm_bignum:
+	case scm_flonum:{
+		char *str = number_to_string(obj, 10);
+		fputs(str, out);
+		free(str);
 		break;
+	}
 
 	case scm_bool:
 		fprintf(out, obj2bool(obj) ? "#t" : "#f");
@@ -832,6 +2250,26 @@ void print(FILE *out, object *obj, int display)
 		print_list(out, obj, display);
 		break;
 
+	case scm_vector:{
+		int i;
+		fprintf(out, "#(");
+		for (i = 0; i < obj->data.frame.size; i++){
+			if (i) fputc(' ', out);
+			print(out, FRAME_SLOTS(obj)[i], display);
+		}
+		fputc(')', out);
+		break;
+	}
+
+	case scm_bytevector:{
+		size_t i;
+		fprintf(out, "#u8(");
+		for (i = 0; i < obj->data.bytevector.length; i++)
+			fprintf(out, i ? " %d" : "%d", obj->data.bytevector.bytes[i]);
+		fputc(')', out);
+		break;
+	}
+
 	case scm_symbol:
 		fprintf(out, "%s", sym2str(obj));
 		break;
@@ -841,9 +2279,22 @@ void print(FILE *out, object *obj, int display)
 		break;
 
 	case scm_lambda:
+	case scm_closure:
 		fprintf(out, "#<procedure>");
 		break;
 
+	case scm_code:
+		fprintf(out, "#<compiled code>");
+		break;
+
+	case scm_table:
+		fprintf(out, "#<hash table>");
+		break;
+
+	case scm_node:
+		fprintf(out, "#<analyzed code>");
+		break;
+
 	case scm_file:
 		fprintf(out, "#<%s port>", port_direction(obj) ? "Input" : "Output");
 		break;
@@ -870,12 +2321,12 @@ void print(FILE *out, object *obj, int display)
 		break;
 
 	case scm_str:
-		if (display) fprintf(out, "%s", obj2str(obj));
+		if (display) fwrite(obj->data.str.chars, 1, obj->data.str.length, out);
 		else {
-			char *ptr = obj2str(obj);
+			char *ptr = obj->data.str.chars, *end = ptr + obj->data.str.length;
 
 			fputc('"', out);
-			while (*ptr != '\0'){
+			while (ptr < end){
 				char c = *ptr++;
 				switch (c){
 				case '\n':
@@ -889,6 +2340,7 @@ void print(FILE *out, object *obj, int display)
 					break;
 				case '"':
 					fprintf(out, "\\\"");
+					break;
 				default:
 					fputc(c, out);
 				}
@@ -898,16 +2350,441 @@ void print(FILE *out, object *obj, int display)
 		break;
 
 	default:
-		fprintf(stderr, "Unknown data type in write: %d.\n", obj->type);
+		fprintf(stderr, "Unknown data type in write: %d.\n", type_of(obj));
 		exit(1);
 	}
 }
 
-
 /*
- * REPL
+ * Images
+ *
+ * save_image writes everything reachable from the symbol table to a file,
+ * and load_image reads it back into a process that has just run
+ * init_constants and init_enviroment, so that a session can start where
+ * an earlier one left off instead of loading its libraries again.
+ *
+ * An image is a header, then a record for each object, then the strings
+ * the records refer to. A record is a word holding the type and the
+ * number of frame slots that follow the record, then four words of
+ * fields. A reference is an immediate object as it is, or an index
+ * shifted left three bits: index 0 is NULL, 1 the global enviroment and
+ * 2 on the records in order. Symbols that were interned are interned
+ * again, so they merge with the ones init_constants made. Pointers into
+ * the executable don't survive rebuilding it, so a primitive is saved as
+ * the name it was defined with and a node has its op. Bignums and flonums are saved as the text they print as,
+ * a string as its characters and their length, as it can hold NULs, and
+ * a bytevector the same way. A vector is saved like a frame, and a hash
+ * table is rehashed when it's next used.
  */
 
+#define IMAGE_MAGIC "SIMG"
+#define IMAGE_VERSION 6
+#define IMAGE_FIELDS 4
+
+struct image_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t nnode_ops;             /* a different set means a different interpreter */
+	uint32_t nobjects;
+	uint64_t nwords;                /* of records */
+	uint64_t strings_size;
+};
+
+
+struct image_writer {
+	object **objects;               /* in record order, from index 2 */
+	size_t nobjects, objects_size;
+	object **seen;                  /* open addressing, the index is in indices */
+	uint32_t *indices;
+	size_t seen_size;
+	uint64_t *words;
+	size_t nwords, words_size;
+	char *strings;
+	size_t strings_size, strings_cap;
+};
+
+static void *image_grow(void *array, size_t *size, size_t elem_size)
+{
+	*size = *size ? *size * 2 : 1024;
+	array = realloc(array, *size * elem_size);
+	if (array == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return array;
+}
+
+static size_t seen_slot(struct image_writer *w, object *obj)
+{
+	size_t i = ((uintptr_t) obj >> 3) * 2654435761u & (w->seen_size - 1);
+	while (w->seen[i] != NULL && w->seen[i] != obj)
+		i = (i + 1) & (w->seen_size - 1);
+	return i;
+}
+
+/* obj's index, numbering it if it hasn't been seen */
+static uint32_t image_index(struct image_writer *w, object *obj)
+{
+	size_t i, old_size;
+	object **old_seen;
+	uint32_t *old_indices;
+
+	i = seen_slot(w, obj);
+	if (w->seen[i] == obj)
+		return w->indices[i];
+
+	if (w->nobjects == w->objects_size)
+		w->objects = image_grow(w->objects, &w->objects_size, sizeof(object *));
+	w->objects[w->nobjects++] = obj;
+	w->seen[i] = obj;
+	w->indices[i] = w->nobjects + 1;
+
+	if (w->nobjects * 2 > w->seen_size){ /* keep the load factor under 1/2 */
+		old_seen = w->seen;
+		old_indices = w->indices;
+		old_size = w->seen_size;
+		w->seen_size *= 2;
+		w->seen = calloc(w->seen_size, sizeof(object *));
+		w->indices = malloc(w->seen_size * sizeof(uint32_t));
+		if (w->seen == NULL || w->indices == NULL){
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		for (i = 0; i < old_size; i++)
+			if (old_seen[i] != NULL){
+				size_t j = seen_slot(w, old_seen[i]);
+				w->seen[j] = old_seen[i];
+				w->indices[j] = old_indices[i];
+			}
+		free(old_seen);
+		free(old_indices);
+	}
+	return w->nobjects + 1;
+}
+
+static uint64_t image_ref(struct image_writer *w, object *obj)
+{
+	if (obj == NULL)
+		return 0;
+	if (is_immediate(obj))
+		return (uintptr_t) obj;
+	if (obj == global_enviroment)
+		return 1 << 3;
+	return (uint64_t) image_index(w, obj) << 3;
+}
+
+static void image_word(struct image_writer *w, uint64_t word)
+{
+	if (w->nwords == w->words_size)
+		w->words = image_grow(w->words, &w->words_size, sizeof(uint64_t));
+	w->words[w->nwords++] = word;
+}
+
+static uint64_t image_chars(struct image_writer *w, char *chars, size_t length)
+{
+	size_t offset = w->strings_size;
+	while (w->strings_size + length + 1 > w->strings_cap)
+		w->strings = image_grow(w->strings, &w->strings_cap, 1);
+	memcpy(w->strings + offset, chars, length);
+	w->strings[offset + length] = '\0';
+	w->strings_size += length + 1;
+	return offset;
+}
+
+static uint64_t image_string(struct image_writer *w, char *str)
+{
+	return image_chars(w, str, strlen(str));
+}
+
+static int is_interned(object *sym)
+{
+	size_t i;
+	for (i = sym->data.sym.hash & (symbol_table_size - 1); symbol_table[i] != NULL; 
+		 i = (i + 1) & (symbol_table_size - 1))
+		if (symbol_table[i] == sym)
+			return 1;
+	return 0;
+}
+
+static void image_record(struct image_writer *w, object *obj)
+{
+	uint64_t fields[IMAGE_FIELDS] = {0};
+	int i, nslots = 0;
+
+	switch (obj->type){
+	case scm_pair:
+		fields[0] = image_ref(w, obj->data.pair.car);
+		fields[1] = image_ref(w, obj->data.pair.cdr);
+		break;
+	case scm_symbol:
+		fields[0] = image_string(w, obj->data.sym.name);
+		fields[1] = image_ref(w, obj->data.sym.value);
+		fields[2] = obj->data.sym.syntax;
+		fields[3] = is_interned(obj);
+		break;
+	case scm_str:
+		fields[0] = image_chars(w, obj->data.str.chars, obj->data.str.length);
+		fields[1] = obj->data.str.length;
+		break;
+	case scm_bignum:
+	case scm_flonum:{
+		char *str = number_to_string(obj, 10);
+		fields[0] = image_string(w, str);
+		free(str);
+		break;
+	}
+	case scm_prim_fun:
+		fields[0] = image_string(w, obj->data.prim.name);
+		break;
+	case scm_lambda:
+		fields[0] = image_ref(w, obj->data.lambda.env);
+		fields[1] = image_ref(w, obj->data.lambda.args);
+		fields[2] = image_ref(w, obj->data.lambda.code);
+		fields[3] = (uint64_t) obj->data.lambda.frame_size 
+				  | (uint64_t) (uint16_t) obj->data.lambda.nreq << 32
+				  | (uint64_t) obj->data.lambda.rest << 48;
+		break;
+	case scm_node:
+		fields[0] = obj->data.node.op;
+		fields[1] = image_ref(w, obj->data.node.a);
+		fields[2] = image_ref(w, obj->data.node.b);
+		fields[3] = image_ref(w, obj->data.node.c);
+		break;
+	case scm_frame:
+	case scm_vector:
+		fields[0] = image_ref(w, obj->data.frame.parent);
+		nslots = obj->data.frame.size;
+		break;
+	case scm_bytevector:
+		fields[0] = image_chars(w, (char *) obj->data.bytevector.bytes, obj->data.bytevector.length);
+		fields[1] = obj->data.bytevector.length;
+		break;
+	case scm_table:
+		fields[0] = image_ref(w, obj->data.table.slots);
+		fields[1] = image_ref(w, obj->data.table.old_slots);
+		fields[2] = (uint32_t) obj->data.table.count | (uint64_t) obj->data.table.used << 32;
+		fields[3] = (uint32_t) obj->data.table.moved | (uint64_t) obj->data.table.kind << 32;
+		break;
+	case scm_file:
+		fields[0] = obj->data.port.direction; /* saved closed */
+		break;
+	default:
+		eval_err("Can't save in an image:", obj);
+	}
+
+	image_word(w, obj->type | (uint64_t) nslots << 32);
+	for (i = 0; i < IMAGE_FIELDS; i++)
+		image_word(w, fields[i]);
+	for (i = 0; i < nslots; i++)
+		image_word(w, image_ref(w, FRAME_SLOTS(obj)[i]));
+}
+
+void save_image(char *path)
+{
+	struct image_writer w = {0};
+	struct image_header h = {.version = 0};
+	FILE *out;
+	size_t i;
+
+	w.seen_size = 1024;
+	w.seen = calloc(w.seen_size, sizeof(object *));
+	w.indices = malloc(w.seen_size * sizeof(uint32_t));
+	if (w.seen == NULL || w.indices == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (i = 0; i < symbol_table_size; i++)
+		if (symbol_table[i] != NULL)
+			image_index(&w, symbol_table[i]);
+	/* records are written as they're numbered, so this is a breadth first walk */
+	for (i = 0; i < w.nobjects; i++)
+		image_record(&w, w.objects[i]);
+
+	memcpy(h.magic, IMAGE_MAGIC, 4);
+	h.version = IMAGE_VERSION;
+	h.nnode_ops = num_node_ops;
+	h.nobjects = w.nobjects;
+	h.nwords = w.nwords;
+	h.strings_size = w.strings_size;
+
+	if ((out = fopen(path, "wb")) == NULL)
+		eval_err("Could not open", make_str(path));
+	fwrite(&h, sizeof(h), 1, out);
+	fwrite(w.words, sizeof(uint64_t), w.nwords, out);
+	fwrite(w.strings, 1, w.strings_size, out);
+	if (ferror(out) | fclose(out))
+		eval_err("Could not write", make_str(path));
+
+	free(w.objects);
+	free(w.seen);
+	free(w.indices);
+	free(w.words);
+	free(w.strings);
+}
+
+static void image_err(char *msg, char *path)
+{
+	fprintf(stderr, "%s: %s.\n", path, msg);
+	exit(1);
+}
+
+void load_image(char *path)
+{
+	struct image_header *h;
+	struct stat st;
+	uint64_t *words, *record, *end;
+	object **objects, *obj;
+	char *base = MAP_FAILED, *strings, *name;
+	size_t nobjects, size, i, k;
+	FILE *file;
+
+	if ((file = fopen(path, "rb")) == NULL)
+		image_err("could not open the image", path);
+	if (fstat(fileno(file), &st) == 0 && st.st_size >= 0 && (size_t) st.st_size >= sizeof(*h))
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	fclose(file);
+	if (base == MAP_FAILED)
+		image_err("not an image", path);
+	size = st.st_size;
+
+	h = (struct image_header *) base;
+	if (memcmp(h->magic, IMAGE_MAGIC, 4) != 0)
+		image_err("not an image", path);
+	if (h->version != IMAGE_VERSION || h->nnode_ops != num_node_ops)
+		image_err("the image is from a different version of the interpreter", path);
+	if (h->nwords > (size - sizeof(*h)) / sizeof(uint64_t) 
+		|| h->strings_size != size - sizeof(*h) - h->nwords * sizeof(uint64_t)
+		|| (h->strings_size && base[size - 1] != '\0'))
+		image_err("the image is truncated", path);
+	words = (uint64_t *) (h + 1);
+	end = words + h->nwords;
+	strings = (char *) end;
+
+	nobjects = h->nobjects + 2;
+	objects = malloc(nobjects * sizeof(object *));
+	if (objects == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	objects[0] = NULL;
+	objects[1] = global_enviroment;
+
+	/* make the objects, then fill them in, as records refer to later ones */
+	for (record = words, k = 2; k < nobjects; k++, record += 1 + IMAGE_FIELDS + (record[0] >> 32)){
+		if (end - record < 1 + IMAGE_FIELDS || (uint64_t) (end - record - 1 - IMAGE_FIELDS) < (record[0] >> 32))
+			image_err("the image is corrupt", path);
+		name = record[1] < h->strings_size ? strings + record[1] : NULL;
+		switch (record[0] & 0xff){
+		case scm_symbol:
+			if (name == NULL)
+				image_err("the image is corrupt", path);
+			objects[k] = record[4] ? get_symbol(name) : make_symbol(name);
+			break;
+		case scm_str:
+			if (name == NULL || record[2] >= h->strings_size - record[1])
+				image_err("the image is corrupt", path);
+			objects[k] = make_str_len(name, record[2]);
+			break;
+		case scm_bignum:
+		case scm_flonum:
+			if (name == NULL || (objects[k] = string_to_number(name, 10)) == NULL)
+				image_err("the image is corrupt", path);
+			break;
+		case scm_prim_fun:
+			if (name == NULL)
+				image_err("the image is corrupt", path);
+			obj = get_symbol(name)->data.sym.value;
+			if (obj == NULL || !is_heap_type(obj, scm_prim_fun) || strcmp(obj->data.prim.name, name))
+				image_err("the image needs a primitive the interpreter hasn't got", path);
+			objects[k] = obj;
+			break;
+		case scm_frame:
+		case scm_vector:
+			objects[k] = alloc_large(record[0] & 0xff, record[0] >> 32);
+			break;
+		case scm_bytevector:
+			if (name == NULL || record[2] >= h->strings_size - record[1])
+				image_err("the image is corrupt", path);
+			objects[k] = make_bytevector(record[2], 0);
+			memcpy(objects[k]->data.bytevector.bytes, name, record[2]);
+			break;
+		case scm_file:
+			objects[k] = make_port(NULL, record[1]);
+			break;
+		case scm_pair:
+		case scm_lambda:
+		case scm_node:
+		case scm_table:
+			objects[k] = alloc_old(record[0] & 0xff);
+			break;
+		default:
+			image_err("the image is corrupt", path);
+		}
+	}
+	if (record != end)
+		image_err("the image is corrupt", path);
+
+#define REF(word) ((word) & TAG_MASK ? (object *) (uintptr_t) (word) \
+				   : ((word) >> 3) < nobjects ? objects[(word) >> 3] \
+				   : (image_err("the image is corrupt", path), NULL))
+#define SET(field, word) (obj->field = REF(word), write_barrier(obj, obj->field))
+	for (record = words, k = 2; k < nobjects; k++, record += 1 + IMAGE_FIELDS + (record[0] >> 32)){
+		obj = objects[k];
+		switch (record[0] & 0xff){
+		case scm_pair:
+			SET(data.pair.car, record[1]);
+			SET(data.pair.cdr, record[2]);
+			break;
+		case scm_symbol:
+			SET(data.sym.value, record[2]);
+			obj->data.sym.syntax = record[3];
+			break;
+		case scm_lambda:
+			SET(data.lambda.env, record[1]);
+			SET(data.lambda.args, record[2]);
+			SET(data.lambda.code, record[3]);
+			obj->data.lambda.frame_size = (int32_t) record[4];
+			obj->data.lambda.nreq = (int16_t) (record[4] >> 32);
+			obj->data.lambda.rest = record[4] >> 48;
+			break;
+		case scm_node:
+			if (record[1] >= num_node_ops)
+				image_err("the image is corrupt", path);
+			obj->data.node.op = record[1];
+			SET(data.node.a, record[2]);
+			SET(data.node.b, record[3]);
+			SET(data.node.c, record[4]);
+			break;
+		case scm_table:
+			SET(data.table.slots, record[1]);
+			SET(data.table.old_slots, record[2]);
+			if (!is_heap_type(obj->data.table.slots, scm_vector))
+				image_err("the image is corrupt", path);
+			obj->data.table.count = (uint32_t) record[3];
+			obj->data.table.used = record[3] >> 32;
+			obj->data.table.moved = (uint32_t) record[4];
+			obj->data.table.kind = record[4] >> 32;
+			table_moved(obj); /* it's hashed by addresses that have changed */
+			break;
+		case scm_frame:
+		case scm_vector:
+			SET(data.frame.parent, record[1]);
+			for (i = 0; i < (size_t) obj->data.frame.size; i++){
+				FRAME_SLOTS(obj)[i] = REF(record[1 + IMAGE_FIELDS + i]);
+				write_barrier(obj, FRAME_SLOTS(obj)[i]);
+			}
+			break;
+		}
+	}
+#undef REF
+#undef SET
+
+	free(objects);
+	munmap(base, size);
+}
+
+
+/* binds ARGS to the command line arguments */
 void set_arg_var(int argc, const char **argv)
 {
 	object *list = empty_list;
@@ -917,19 +2794,3 @@ void set_arg_var(int argc, const char **argv)
 	}
 	define_var(get_symbol("ARGS"), list, global_enviroment);
 }
-
-int main(int argc, const char **argv)
-{
-	printf("Welcome to bootstrap scheme. \n"
-		  "Press ctrl-c or type (exit) to exit. \n");
-
-	init_constants();
-	init_enviroment(global_enviroment);
-	set_arg_var(argc, argv);
-
-	while(1){
-		printf("> ");
-		print(stdout, eval(read(stdin), global_enviroment), 0);
-		printf("\n");
-	}
-}
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define BOOTSTRAP_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "../cxrs.h"
 #include "../util.h"
 
@@ -12,11 +13,27 @@
 
 typedef struct object object;
 
-object *true;
-object *false;
-object *eof;
-object *empty_list;
-object *global_enviroment;
+/*
+ * Fixnums, characters, booleans, the empty list and the eof object are
+ * immediates: they are encoded in the bits of the object pointer instead 
+ * of being allocated. Heap objects are 8 byte aligned, so a real pointer 
+ * has its low three bits clear.
+ *
+ *   ...iiii1  fixnum, shifted left by one
+ *   ...cc010  character, shifted left by three
+ *   ...xx110  one of the constants below
+ */
+#define FIXNUM_TAG 1
+#define CHAR_TAG 2
+#define CONST_TAG 6
+#define TAG_MASK 7
+
+#define false      ((object *) 0x06)
+#define true       ((object *) 0x0e)
+#define empty_list ((object *) 0x16)
+#define eof        ((object *) 0x1e)
+
+extern object *global_enviroment;
 
 enum obj_type {
 	scm_bool,
@@ -29,30 +46,172 @@ enum obj_type {
 	scm_prim_fun,
 	scm_lambda,
 	scm_str,
-	scm_file
+	scm_file,
+	scm_node,
+	scm_frame,
+	scm_code,
+	scm_closure,
+	scm_bignum,
+	scm_flonum,
+	scm_vector,
+	scm_bytevector,
+	scm_table,
+	scm_num_types /* not a type, the number of types */
 };
 
 typedef object *(*prim_proc)(object *args);
 
-object *read(FILE *in);
+extern source *stdin_source;
+object *read_datum(source *in);
 object *eval(object *code, object *env);
+object *apply(object *proc, object *args);
+extern object *(*apply_closure)(object *proc, object *args); /* for a scm_closure, if set */
+
+/* the most words eval's stack can grow to, so how deep calls can nest */
+#define EVAL_STACK_LIMIT (1 << 22)
+extern size_t eval_stack_limit;
 void print(FILE *out, object *obj, int display);
 
 int check_type(enum obj_type type, object *obj, int err_on_false);
 
+/* 
+ * The collector only runs inside eval, so any object held in a C variable
+ * across a call to eval must be registered with gc_protect. gc_depth and
+ * gc_release unregister everything protected since a given point.
+ */
+void gc_protect(object **root);
+void gc_protect_stack(object **bottom, object ***top); /* everything from bottom up to *top */
+int gc_depth(void);
+void gc_release(int depth);
+void gc_collect(void);
+void gc_trim(void);
+
+struct gc_stats {
+	long allocs;            /* objects bump allocated in the nursery */
+	long old_allocs;        /* objects allocated in the old space, including promotions */
+	long promoted;          /* objects copied out of the nursery */
+	long minor_collections;
+	long major_collections;
+	long chunks;            /* old space chunks held */
+	long live;              /* old objects that survived the last major collection */
+};
+struct gc_stats *gc_statistics(void);
+
 static inline int is_true(object *obj){return obj != false;}
 
-object *make_int(int value);
-int obj2int(object *i);
+static inline int is_immediate(object *obj){return ((uintptr_t) obj & TAG_MASK) != 0;}
+static inline int is_fixnum(object *obj){return (uintptr_t) obj & FIXNUM_TAG;}
+static inline int is_char(object *obj){return ((uintptr_t) obj & TAG_MASK) == CHAR_TAG;}
+static inline int is_bool(object *obj){return obj == true || obj == false;}
+
+/* make_int's value must be in fixnum range, see make_integer for any value */
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
+static inline object *make_int(intptr_t value)
+{
+	return (object *) (((uintptr_t) value << 1) | FIXNUM_TAG);
+}
+static inline intptr_t obj2int(object *obj)
+{
+	if(!is_fixnum(obj))
+		check_type(scm_int, obj, 1);
+	return (intptr_t) obj >> 1;
+}
+
+static inline object *make_bool(int value){return value ? true : false;}
+static inline int obj2bool(object *obj)
+{
+	if(!is_bool(obj))
+		check_type(scm_bool, obj, 1);
+	return obj == true;
+}
+
+static inline object *make_char(char c)
+{
+	return (object *) (((uintptr_t) (unsigned char) c << 3) | CHAR_TAG);
+}
+static inline char obj2char(object *obj)
+{
+	if(!is_char(obj))
+		check_type(scm_char, obj, 1);
+	return (char) ((uintptr_t) obj >> 3);
+}
 
-object *make_bool(int value);
-int obj2bool(object *b);
+/*
+ * Numbers (numbers.c): integers are fixnums while they fit and bignums
+ * when they don't, and flonums are doubles. The fixnum cases of the
+ * commonest operations are inline; they work on the tagged words, and
+ * only call out when a result overflows or an argument isn't a fixnum.
+ */
+int is_number(object *obj);
+int is_integer(object *obj); /* flonums without a fraction too */
+int is_exact_integer(object *obj);
+object *make_integer(intptr_t value);
+object *make_flonum(double value);
+double obj2double(object *num);
+object *exact_to_inexact(object *num);
+object *inexact_to_exact(object *num);
 
-object *make_char(char c);
-char obj2char(object *ch);
+object *add_numbers(object *a, object *b);
+object *sub_numbers(object *a, object *b);
+object *mul_numbers(object *a, object *b);
+int compare_numbers(object *a, object *b); /* -1, 0 or 1, or 2 if either is a NaN */
+object *num_divide(object *a, object *b);
+object *num_quotient(object *a, object *b);
+object *num_remainder(object *a, object *b);
+object *num_modulo(object *a, object *b);
+
+object *string_to_number(char *str, int radix); /* NULL if it isn't a number */
+char *number_to_string(object *num, int radix); /* malloced */
+
+static inline int both_fixnums(object *a, object *b)
+{
+	return (uintptr_t) a & (uintptr_t) b & FIXNUM_TAG;
+}
+
+/* (2a + 1) + (2b + 1) - 1 = 2(a + b) + 1 */
+static inline object *num_add(object *a, object *b)
+{
+	intptr_t sum;
+	if (both_fixnums(a, b) 
+	    && !__builtin_add_overflow((intptr_t) a, (intptr_t) b - FIXNUM_TAG, &sum))
+		return (object *) sum;
+	return add_numbers(a, b);
+}
+
+static inline object *num_sub(object *a, object *b)
+{
+	intptr_t difference;
+	if (both_fixnums(a, b) 
+	    && !__builtin_sub_overflow((intptr_t) a, (intptr_t) b - FIXNUM_TAG, &difference))
+		return (object *) difference;
+	return sub_numbers(a, b);
+}
+
+/* a * 2b + 1 = 2ab + 1 */
+static inline object *num_mul(object *a, object *b)
+{
+	intptr_t product;
+	if (both_fixnums(a, b) 
+	    && !__builtin_mul_overflow((intptr_t) a >> 1, (intptr_t) b - FIXNUM_TAG, &product))
+		return (object *) (product | FIXNUM_TAG);
+	return mul_numbers(a, b);
+}
+
+/* fixnums compare the same way as their tagged words */
+static inline int num_compare(object *a, object *b)
+{
+	if (both_fixnums(a, b))
+		return ((intptr_t) a > (intptr_t) b) - ((intptr_t) a < (intptr_t) b);
+	return compare_numbers(a, b);
+}
 
 object *make_str(char *str);
+object *make_str_len(char *chars, size_t length); /* chars NULL leaves them to fill in */
 char *obj2str(object *str);
+size_t str_length(object *str);
+void str_append_str(object *str, object *more); /* in place, growing str by doubling */
 
 object *cons(object *car, object *cdr);
 object *car(object *pair);
@@ -64,16 +223,46 @@ object *make_symbol(char *name);
 char *sym2str(object *sym);
 object *get_symbol(char *name) __attribute__((pure));
 
-object *make_prim_fun(prim_proc fun);
+object *make_prim_fun(prim_proc fun, char *name); /* name isn't copied */
 prim_proc obj2prim_proc(object *proc);
 
-object *make_lambda(object *args, object *code, object *env);
+object *make_lambda(object *args, object *code, object *env, int frame_size);
 object *lambda_code(object *lambda);
 object *lambda_args(object *lambda);
 
+object *make_vector(size_t length, object *fill);
+size_t vector_length(object *vector);
+object **vector_slots(object *vector); /* store into them with vector_set */
+object *vector_ref(object *vector, object *index);
+void vector_set(object *vector, object *index, object *value);
+void vector_fill(object *vector, object *fill, size_t start, size_t end);
+object *list_to_vector(object *list);
+object *vector_to_list(object *vector, size_t start, size_t end);
+
+object *make_bytevector(size_t length, int fill);
+int obj2byte(object *obj); /* errors unless it's from 0 to 255 */
+size_t bytevector_length(object *bytevector);
+unsigned char *bytevector_bytes(object *bytevector);
+object *list_to_bytevector(object *list);
+
+/* Hash tables (tables.c): strings are keys by their contents in string tables */
+enum table_kind {table_eq, table_eqv, table_string};
+enum table_entries {table_keys, table_values, table_pairs};
+object *make_table(enum table_kind kind);
+object *table_ref(object *table, object *key); /* NULL if it isn't there */
+void table_set(object *table, object *key, object *value);
+int table_delete(object *table, object *key);  /* 0 if it wasn't there */
+size_t table_count(object *table);
+object *table_entries(object *table, enum table_entries what); /* a list, in no order */
+void table_clear(object *table);
+void table_moved(object *table);
+
 object *make_port(FILE *handle, int direction);
+object *make_string_port(void); /* an output port that writes to memory */
+object *string_port_contents(object *port);
 int port_direction(object *port);
 FILE *port_handle(object *port);
+source *port_source(object *port);
 void set_port_handle_to_null(object *port);
 
 /*both of these should never be called*/
@@ -83,7 +272,13 @@ object *eval_proc(object *);
 
 object *maybe_add_begin(object *code);
 
+void init_constants(void);
 void init_enviroment(object *env);
+void set_arg_var(int argc, const char **argv);
+
+/* an image holds everything reachable from the symbol table, see bootstrap.c */
+void save_image(char *path);
+void load_image(char *path); /* after init_constants and init_enviroment */
 
 
 void eval_err(char *msg, object *code) __attribute__((noreturn));
@@ -0,0 +1,35 @@
+/*
+ * REPL
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bootstrap.h"
+
+int main(int argc, const char **argv)
+{
+	printf("Welcome to bootstrap scheme. \n"
+		  "Press ctrl-c or type (exit) to exit. \n");
+
+	init_constants();
+	init_enviroment(global_enviroment);
+	while(argc > 2){
+		if(!strcmp(argv[1], "--image"))
+			load_image((char *) argv[2]);
+		else if(!strcmp(argv[1], "--stack-limit") && atol(argv[2]) > 0)
+			eval_stack_limit = atol(argv[2]);
+		else
+			break;
+		argv[2] = argv[0];
+		argc -= 2;
+		argv += 2;
+	}
+	set_arg_var(argc, argv);
+
+	while(1){
+		printf("> ");
+		print(stdout, eval(read_datum(stdin_source), global_enviroment), 0);
+		printf("\n");
+	}
+}
@@ -0,0 +1,754 @@
+/*
+ * Numbers: exact integers of any size, and flonums.
+ *
+ * An integer is a fixnum (see bootstrap.h) whenever it fits in one, and
+ * a bignum only when it doesn't, so two equal integers always have the
+ * same representation. A bignum's magnitude is an array of 32 bit digits,
+ * least significant first, with its sign kept apart. The fixnum cases of
+ * +, - * and the comparisons are inline in bootstrap.h, and only come
+ * here when they overflow or meet another kind of number.
+ *
+ * Bignums own malloced digits, so they're allocated old, like strings;
+ * flonums are allocated in the nursery. Nothing here collects.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "bootstrap.h"
+#include "object.h"
+
+/* a magnitude and sign, borrowed from a bignum or made from a fixnum */
+struct big {
+	uint32_t *digits;
+	int length;
+	int sign;
+	uint32_t buf[2];  /* the digits of a fixnum */
+};
+
+static void *num_alloc(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+	if (p == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return p;
+}
+
+static inline int is_bignum(object *obj)
+{
+	return is_heap_type(obj, scm_bignum);
+}
+
+static inline int is_flonum(object *obj)
+{
+	return is_heap_type(obj, scm_flonum);
+}
+
+int is_number(object *obj)
+{
+	return is_fixnum(obj) || is_bignum(obj) || is_flonum(obj);
+}
+
+int is_exact_integer(object *obj)
+{
+	return is_fixnum(obj) || is_bignum(obj);
+}
+
+int is_integer(object *obj)
+{
+	return is_exact_integer(obj)
+		|| (is_flonum(obj) && obj->data.flonum == floor(obj->data.flonum)
+		    && !isinf(obj->data.flonum));
+}
+
+static void not_a_number(object *obj)
+{
+	eval_err("Not a number:", obj);
+}
+
+static void check_number(object *obj)
+{
+	if (!is_number(obj))
+		not_a_number(obj);
+}
+
+static void check_integer(object *obj)
+{
+	if (!is_integer(obj))
+		eval_err("Not an integer:", obj);
+}
+
+object *make_flonum(double value)
+{
+	object *obj = alloc_obj(scm_flonum);
+	obj->data.flonum = value;
+	return obj;
+}
+
+/* takes over digits, which may have leading zeros */
+static object *make_bignum(uint32_t *digits, int length, int sign)
+{
+	object *obj;
+	uint64_t mag;
+
+	while (length > 0 && digits[length - 1] == 0)
+		length--;
+	if (length <= 2){
+		mag = length == 0 ? 0 : length == 1 ? digits[0]
+			: (uint64_t) digits[1] << 32 | digits[0];
+		if (sign > 0 ? mag <= FIXNUM_MAX : mag <= (uint64_t) FIXNUM_MAX + 1){
+			free(digits);
+			return make_int(sign > 0 ? (intptr_t) mag : (intptr_t) -(int64_t) mag);
+		}
+	}
+	obj = alloc_old(scm_bignum);
+	obj->data.big.digits = realloc(digits, length * sizeof(uint32_t));
+	obj->data.big.length = length;
+	obj->data.big.sign = sign;
+	return obj;
+}
+
+static object *make_integer64(int64_t value)
+{
+	uint32_t *digits;
+	uint64_t mag;
+
+	if (value >= FIXNUM_MIN && value <= FIXNUM_MAX)
+		return make_int(value);
+	mag = value < 0 ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+	digits = num_alloc(2 * sizeof(uint32_t));
+	digits[0] = (uint32_t) mag;
+	digits[1] = (uint32_t) (mag >> 32);
+	return make_bignum(digits, 2, value < 0 ? -1 : 1);
+}
+
+object *make_integer(intptr_t value)
+{
+	return make_integer64(value);
+}
+
+static void as_big(object *obj, struct big *b)
+{
+	intptr_t value;
+	uint64_t mag;
+
+	if (is_bignum(obj)){
+		b->digits = obj->data.big.digits;
+		b->length = obj->data.big.length;
+		b->sign = obj->data.big.sign;
+		return;
+	}
+	value = obj2int(obj);
+	b->sign = value < 0 ? -1 : 1;
+	mag = value < 0 ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+	b->buf[0] = (uint32_t) mag;
+	b->buf[1] = (uint32_t) (mag >> 32);
+	b->digits = b->buf;
+	b->length = mag == 0 ? 0 : b->buf[1] == 0 ? 1 : 2;
+}
+
+double obj2double(object *obj)
+{
+	double d = 0;
+	int i;
+
+	if (is_fixnum(obj))
+		return (double) obj2int(obj);
+	if (is_flonum(obj))
+		return obj->data.flonum;
+	if (!is_bignum(obj))
+		not_a_number(obj);
+	for (i = obj->data.big.length - 1; i >= 0; i--)
+		d = d * 4294967296.0 + obj->data.big.digits[i];
+	return obj->data.big.sign * d;
+}
+
+/* the integer a flonum without a fraction is */
+static object *double_to_integer(double d)
+{
+	uint32_t *digits;
+	int length, i;
+	double mag = fabs(d);
+
+	if (mag < 9007199254740992.0) /* 2^53, which every fixnum range covers */
+		return make_integer64((int64_t) d);
+	frexp(mag, &length);
+	length = (length + 31) / 32;
+	digits = num_alloc(length * sizeof(uint32_t));
+	for (i = length - 1; i >= 0; i--){
+		double unit = ldexp(1, 32 * i), digit = floor(mag / unit);
+		digits[i] = (uint32_t) digit;
+		mag -= digit * unit;
+	}
+	return make_bignum(digits, length, d < 0 ? -1 : 1);
+}
+
+object *exact_to_inexact(object *obj)
+{
+	return is_flonum(obj) ? obj : make_flonum(obj2double(obj));
+}
+
+object *inexact_to_exact(object *obj)
+{
+	check_number(obj);
+	if (!is_flonum(obj))
+		return obj;
+	if (!is_integer(obj))
+		eval_err("No exact integer for", obj);
+	return double_to_integer(obj->data.flonum);
+}
+
+/*
+ * Magnitudes
+ */
+
+static int mag_compare(uint32_t *a, int alen, uint32_t *b, int blen)
+{
+	if (alen != blen)
+		return alen < blen ? -1 : 1;
+	while (alen-- > 0)
+		if (a[alen] != b[alen])
+			return a[alen] < b[alen] ? -1 : 1;
+	return 0;
+}
+
+/* r has room for max(alen, blen) + 1 digits */
+static int mag_add(uint32_t *a, int alen, uint32_t *b, int blen, uint32_t *r)
+{
+	uint64_t carry = 0;
+	int i;
+
+	if (alen < blen){
+		uint32_t *t = a; int tlen = alen;
+		a = b; alen = blen;
+		b = t; blen = tlen;
+	}
+	for (i = 0; i < alen; i++){
+		carry += (uint64_t) a[i] + (i < blen ? b[i] : 0);
+		r[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+	r[i] = (uint32_t) carry;
+	return alen + 1;
+}
+
+/* a - b, where a >= b; r has room for alen digits */
+static int mag_sub(uint32_t *a, int alen, uint32_t *b, int blen, uint32_t *r)
+{
+	int64_t borrow = 0;
+	int i;
+
+	for (i = 0; i < alen; i++){
+		int64_t t = (int64_t) a[i] - (i < blen ? b[i] : 0) - borrow;
+		borrow = t < 0;
+		r[i] = (uint32_t) (t + (borrow << 32));
+	}
+	return alen;
+}
+
+/* r has room for alen + blen digits */
+static int mag_mul(uint32_t *a, int alen, uint32_t *b, int blen, uint32_t *r)
+{
+	uint64_t carry;
+	int i, j;
+
+	memset(r, 0, (alen + blen) * sizeof(uint32_t));
+	for (i = 0; i < alen; i++){
+		carry = 0;
+		for (j = 0; j < blen; j++){
+			carry += (uint64_t) a[i] * b[j] + r[i + j];
+			r[i + j] = (uint32_t) carry;
+			carry >>= 32;
+		}
+		r[i + blen] = (uint32_t) carry;
+	}
+	return alen + blen;
+}
+
+/* divides a in place by d, returning the remainder */
+static uint32_t mag_divide_small(uint32_t *a, int length, uint32_t d)
+{
+	uint64_t rem = 0;
+	int i;
+
+	for (i = length - 1; i >= 0; i--){
+		rem = rem << 32 | a[i];
+		a[i] = (uint32_t) (rem / d);
+		rem %= d;
+	}
+	return (uint32_t) rem;
+}
+
+static int leading_zeros(uint32_t x)
+{
+	int n = 0;
+	while (!(x & 0x80000000u)){
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Long division (Knuth's algorithm D, as in Hacker's Delight), for
+ * alen >= blen >= 2: q gets alen - blen + 1 digits and r gets blen.
+ */
+static void mag_divide(uint32_t *a, int alen, uint32_t *b, int blen, uint32_t *q, uint32_t *r)
+{
+	const uint64_t base = (uint64_t) 1 << 32;
+	uint32_t *u = num_alloc((alen + 1) * sizeof(uint32_t));
+	uint32_t *v = num_alloc(blen * sizeof(uint32_t));
+	int s = leading_zeros(b[blen - 1]), i, j;
+
+	/* shift so that v's top digit has its top bit set */
+	for (i = blen - 1; i > 0; i--)
+		v[i] = b[i] << s | (s ? (uint32_t) ((uint64_t) b[i - 1] >> (32 - s)) : 0);
+	v[0] = b[0] << s;
+	u[alen] = s ? (uint32_t) ((uint64_t) a[alen - 1] >> (32 - s)) : 0;
+	for (i = alen - 1; i > 0; i--)
+		u[i] = a[i] << s | (s ? (uint32_t) ((uint64_t) a[i - 1] >> (32 - s)) : 0);
+	u[0] = a[0] << s;
+
+	for (j = alen - blen; j >= 0; j--){
+		uint64_t num = (uint64_t) u[j + blen] << 32 | u[j + blen - 1];
+		uint64_t qhat = num / v[blen - 1], rhat = num % v[blen - 1];
+		int64_t t, borrow = 0;
+		uint64_t p;
+
+		while (qhat >= base || qhat * v[blen - 2] > (rhat << 32 | u[j + blen - 2])){
+			qhat--;
+			rhat += v[blen - 1];
+			if (rhat >= base)
+				break;
+		}
+		for (i = 0; i < blen; i++){
+			p = qhat * v[i];
+			t = (int64_t) u[i + j] - borrow - (int64_t) (p & 0xffffffffu);
+			u[i + j] = (uint32_t) t;
+			borrow = (int64_t) (p >> 32) - (t >> 32);
+		}
+		t = (int64_t) u[j + blen] - borrow;
+		u[j + blen] = (uint32_t) t;
+
+		q[j] = (uint32_t) qhat;
+		if (t < 0){ /* qhat was one too big, so add v back */
+			uint64_t carry = 0;
+			q[j]--;
+			for (i = 0; i < blen; i++){
+				carry += (uint64_t) u[i + j] + v[i];
+				u[i + j] = (uint32_t) carry;
+				carry >>= 32;
+			}
+			u[j + blen] += (uint32_t) carry;
+		}
+	}
+
+	for (i = 0; i < blen; i++)
+		r[i] = u[i] >> s | (s ? (uint32_t) ((uint64_t) u[i + 1] << (32 - s)) : 0);
+	free(u);
+	free(v);
+}
+
+/*
+ * Exact arithmetic
+ */
+
+static object *big_add(struct big *a, struct big *b)
+{
+	int size = (a->length > b->length ? a->length : b->length) + 1;
+	uint32_t *r = num_alloc(size * sizeof(uint32_t));
+
+	if (a->sign == b->sign)
+		return make_bignum(r, mag_add(a->digits, a->length, b->digits, b->length, r), a->sign);
+	if (mag_compare(a->digits, a->length, b->digits, b->length) >= 0)
+		return make_bignum(r, mag_sub(a->digits, a->length, b->digits, b->length, r), a->sign);
+	return make_bignum(r, mag_sub(b->digits, b->length, a->digits, a->length, r), b->sign);
+}
+
+static object *big_mul(struct big *a, struct big *b)
+{
+	uint32_t *r = num_alloc((a->length + b->length) * sizeof(uint32_t));
+	return make_bignum(r, mag_mul(a->digits, a->length, b->digits, b->length, r), a->sign * b->sign);
+}
+
+/* truncating division, either result may be NULL if it isn't wanted */
+static void big_divide(object *x, object *y, object **quotient, object **remainder)
+{
+	struct big a, b;
+	uint32_t *q, *r;
+	int qlen;
+
+	as_big(x, &a);
+	as_big(y, &b);
+	if (b.length == 0)
+		eval_err("Division by zero:", x);
+	if (mag_compare(a.digits, a.length, b.digits, b.length) < 0){
+		if (quotient) *quotient = make_int(0);
+		if (remainder) *remainder = x;
+		return;
+	}
+	qlen = a.length - b.length + 1;
+	q = num_alloc(qlen * sizeof(uint32_t));
+	r = num_alloc(b.length * sizeof(uint32_t));
+	if (b.length == 1){
+		memcpy(q, a.digits, a.length * sizeof(uint32_t));
+		r[0] = mag_divide_small(q, a.length, b.digits[0]);
+		qlen = a.length;
+	} else
+		mag_divide(a.digits, a.length, b.digits, b.length, q, r);
+	if (quotient) *quotient = make_bignum(q, qlen, a.sign * b.sign);
+	else free(q);
+	if (remainder) *remainder = make_bignum(r, b.length, a.sign);
+	else free(r);
+}
+
+/*
+ * The generic operations, for whatever the inline fixnum paths can't do
+ */
+
+static int either_flonum(object *a, object *b)
+{
+	check_number(a);
+	check_number(b);
+	return is_flonum(a) || is_flonum(b);
+}
+
+object *add_numbers(object *a, object *b)
+{
+	struct big x, y;
+
+	if (either_flonum(a, b))
+		return make_flonum(obj2double(a) + obj2double(b));
+	if (is_fixnum(a) && is_fixnum(b))
+		return make_integer64((int64_t) obj2int(a) + obj2int(b));
+	as_big(a, &x);
+	as_big(b, &y);
+	return big_add(&x, &y);
+}
+
+object *sub_numbers(object *a, object *b)
+{
+	struct big x, y;
+
+	if (either_flonum(a, b))
+		return make_flonum(obj2double(a) - obj2double(b));
+	if (is_fixnum(a) && is_fixnum(b))
+		return make_integer64((int64_t) obj2int(a) - obj2int(b));
+	as_big(a, &x);
+	as_big(b, &y);
+	y.sign = -y.sign;
+	return big_add(&x, &y);
+}
+
+object *mul_numbers(object *a, object *b)
+{
+	struct big x, y;
+
+	if (either_flonum(a, b))
+		return make_flonum(obj2double(a) * obj2double(b));
+	as_big(a, &x);
+	as_big(b, &y);
+	return big_mul(&x, &y);
+}
+
+/* exact if b divides a, a flonum otherwise, as there are no rationals */
+object *num_divide(object *a, object *b)
+{
+	object *q, *r;
+
+	if (either_flonum(a, b))
+		return make_flonum(obj2double(a) / obj2double(b));
+	big_divide(a, b, &q, &r);
+	if (r == make_int(0))
+		return q;
+	return make_flonum(obj2double(a) / obj2double(b));
+}
+
+object *num_quotient(object *a, object *b)
+{
+	object *q;
+
+	check_integer(a);
+	check_integer(b);
+	if (is_flonum(a) || is_flonum(b)){
+		if (obj2double(b) == 0)
+			eval_err("Division by zero:", a);
+		return make_flonum(trunc(obj2double(a) / obj2double(b)));
+	}
+	if (is_fixnum(a) && is_fixnum(b) && b != make_int(0))
+		return make_integer64((int64_t) obj2int(a) / obj2int(b)); /* FIXNUM_MIN / -1 doesn't fit */
+	big_divide(a, b, &q, NULL);
+	return q;
+}
+
+object *num_remainder(object *a, object *b)
+{
+	object *r;
+
+	check_integer(a);
+	check_integer(b);
+	if (is_flonum(a) || is_flonum(b)){
+		if (obj2double(b) == 0)
+			eval_err("Division by zero:", a);
+		return make_flonum(fmod(obj2double(a), obj2double(b)));
+	}
+	if (is_fixnum(a) && is_fixnum(b) && b != make_int(0))
+		return make_int(obj2int(a) % obj2int(b));
+	big_divide(a, b, NULL, &r);
+	return r;
+}
+
+/* the remainder with the sign of b */
+object *num_modulo(object *a, object *b)
+{
+	object *r = num_remainder(a, b);
+
+	if (num_compare(r, make_int(0)) != 0
+	    && (num_compare(r, make_int(0)) < 0) != (num_compare(b, make_int(0)) < 0))
+		r = num_add(r, b);
+	return r;
+}
+
+/* an exact integer against a flonum, exactly */
+static int compare_exact_flonum(object *a, double d)
+{
+	double whole;
+	int c;
+
+	if (isnan(d))
+		return 2;
+	if (isinf(d))
+		return d > 0 ? -1 : 1;
+	whole = floor(d);
+	if ((c = compare_numbers(a, double_to_integer(whole))) != 0)
+		return c;
+	return whole == d ? 0 : -1;
+}
+
+/* -1, 0 or 1 as a is less than, equal to or greater than b, or 2 if either is a NaN */
+int compare_numbers(object *a, object *b)
+{
+	struct big x, y;
+	int c;
+
+	if (either_flonum(a, b)){
+		if (is_flonum(a) && is_flonum(b)){
+			double da = a->data.flonum, db = b->data.flonum;
+			return da < db ? -1 : da > db ? 1 : da == db ? 0 : 2;
+		}
+		if (is_flonum(b))
+			return compare_exact_flonum(a, b->data.flonum);
+		c = compare_exact_flonum(b, a->data.flonum);
+		return c == 2 ? 2 : -c;
+	}
+	if (is_fixnum(a) && is_fixnum(b))
+		return obj2int(a) < obj2int(b) ? -1 : obj2int(a) > obj2int(b);
+	as_big(a, &x);
+	as_big(b, &y);
+	if (x.length == 0) x.sign = 1; /* zero has no sign */
+	if (y.length == 0) y.sign = 1;
+	if (x.sign != y.sign)
+		return x.sign;
+	return x.sign * mag_compare(x.digits, x.length, y.digits, y.length);
+}
+
+/*
+ * Conversions to and from text
+ */
+
+static int digit_value(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+	return 99;
+}
+
+/* magnitude = magnitude * m + a, growing it if need be */
+static void mag_mul_add(uint32_t **digits, int *length, int *size, uint32_t m, uint32_t a)
+{
+	uint64_t carry = a;
+	int i;
+
+	for (i = 0; i < *length; i++){
+		carry += (uint64_t) (*digits)[i] * m;
+		(*digits)[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+	if (carry){
+		if (*length == *size){
+			*size *= 2;
+			if ((*digits = realloc(*digits, *size * sizeof(uint32_t))) == NULL){
+				fprintf(stderr, "Out of memory.\n");
+				exit(1);
+			}
+		}
+		(*digits)[(*length)++] = (uint32_t) carry;
+	}
+}
+
+static object *parse_flonum(char *str)
+{
+	char *end;
+	double d;
+
+	/* the reader has upcased these if they were read as symbols */
+	if (!strcasecmp(str, "+inf.0")) return make_flonum(HUGE_VAL);
+	if (!strcasecmp(str, "-inf.0")) return make_flonum(-HUGE_VAL);
+	if (!strcasecmp(str, "+nan.0") || !strcasecmp(str, "-nan.0")) return make_flonum(NAN);
+	/* strtod takes more than scheme does, such as hex and "inf" */
+	if (strspn(str, "0123456789+-.eE") != strlen(str) || strpbrk(str, "0123456789") == NULL)
+		return NULL;
+	d = strtod(str, &end);
+	if (*end != '\0' || end == str)
+		return NULL;
+	return make_flonum(d);
+}
+
+/* the number str is written as, or NULL if it isn't one */
+object *string_to_number(char *str, int radix)
+{
+	char *p = str;
+	int sign = 1, d, length, size;
+	intptr_t value = 0;
+	uint32_t *digits;
+
+	if (radix < 2 || radix > 36)
+		eval_err("Bad radix:", make_int(radix));
+	if (*p == '-' || *p == '+')
+		sign = *p++ == '-' ? -1 : 1;
+	if (*p == '\0')
+		return NULL;
+	for (; *p != '\0'; p++){
+		if ((d = digit_value(*p)) >= radix)
+			return radix == 10 ? parse_flonum(str) : NULL;
+		if (value > (FIXNUM_MAX - d) / radix)
+			break;
+		value = value * radix + d;
+	}
+	if (*p == '\0')
+		return make_int(sign * value);
+
+	/* too big for a fixnum */
+	size = 4;
+	digits = num_alloc(size * sizeof(uint32_t));
+	digits[0] = (uint32_t) value;
+	digits[1] = (uint32_t) ((uint64_t) value >> 32);
+	length = digits[1] ? 2 : 1;
+	for (; *p != '\0'; p++){
+		if ((d = digit_value(*p)) >= radix){
+			free(digits);
+			return radix == 10 ? parse_flonum(str) : NULL;
+		}
+		mag_mul_add(&digits, &length, &size, radix, d);
+	}
+	return make_bignum(digits, length, sign);
+}
+
+/*
+ * the shortest digits strtod gives d back from, written out in full
+ * between 1e-7 and 1e21 and with an exponent outside that, always with
+ * a point or an exponent so it reads back inexact
+ */
+static char *flonum_to_string(double d)
+{
+	char buf[40], digits[20], out[48], *p = buf, *o = out;
+	int precision, exponent, n = 0, i;
+
+	if (isnan(d)) return strdup("+nan.0");
+	if (isinf(d)) return strdup(d > 0 ? "+inf.0" : "-inf.0");
+	for (precision = 1; precision < 17; precision++){
+		snprintf(buf, sizeof(buf), "%.*e", precision - 1, d);
+		if (strtod(buf, NULL) == d)
+			break;
+	}
+	snprintf(buf, sizeof(buf), "%.*e", precision - 1, d);
+
+	/* split -d.ddde+xx into its digits and exponent */
+	if (*p == '-')
+		*o++ = *p++;
+	for (; *p != 'e'; p++)
+		if (*p != '.')
+			digits[n++] = *p;
+	exponent = atoi(p + 1);
+	while (n > 1 && digits[n - 1] == '0')
+		n--;
+
+	if (exponent < -7 || exponent >= 21){
+		*o++ = digits[0];
+		if (n > 1){
+			*o++ = '.';
+			memcpy(o, digits + 1, n - 1);
+			o += n - 1;
+		}
+		o += sprintf(o, "e%d", exponent);
+	} else if (exponent < 0){
+		*o++ = '0';
+		*o++ = '.';
+		for (i = -1; i > exponent; i--)
+			*o++ = '0';
+		memcpy(o, digits, n);
+		o += n;
+	} else {
+		for (i = 0; i <= exponent; i++)
+			*o++ = i < n ? digits[i] : '0';
+		*o++ = '.';
+		if (n > exponent + 1){
+			memcpy(o, digits + exponent + 1, n - exponent - 1);
+			o += n - exponent - 1;
+		} else
+			*o++ = '0';
+	}
+	*o = '\0';
+	return strdup(out);
+}
+
+/* malloced */
+char *number_to_string(object *num, int radix)
+{
+	static const char digit_chars[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	struct big b;
+	uint32_t *mag, chunk = radix, rem;
+	int chunk_digits = 1, length, i;
+	char *buf, *p;
+
+	if (radix < 2 || radix > 36)
+		eval_err("Bad radix:", make_int(radix));
+	if (is_flonum(num)){
+		if (radix != 10)
+			eval_err("Flonums can only be written in decimal:", num);
+		return flonum_to_string(num->data.flonum);
+	}
+	if (!is_exact_integer(num))
+		not_a_number(num);
+
+	/* divide by the largest power of radix that fits in a digit, for a chunk of digits at a time */
+	while ((uint64_t) chunk * radix <= 0xffffffffu){
+		chunk *= radix;
+		chunk_digits++;
+	}
+	as_big(num, &b);
+	length = b.length;
+	mag = num_alloc((length ? length : 1) * sizeof(uint32_t));
+	memcpy(mag, b.digits, length * sizeof(uint32_t));
+	buf = num_alloc(length * 32 + 3);
+	p = buf + length * 32 + 2;
+	*p = '\0';
+	do {
+		rem = mag_divide_small(mag, length, chunk);
+		while (length > 0 && mag[length - 1] == 0)
+			length--;
+		for (i = 0; i < chunk_digits && (length > 0 || rem != 0 || i == 0); i++){
+			*--p = digit_chars[rem % radix];
+			rem /= radix;
+		}
+	} while (length > 0);
+	if (b.sign < 0 && b.length > 0)
+		*--p = '-';
+	memmove(buf, p, strlen(p) + 1);
+	free(mag);
+	return buf;
+}
@@ -0,0 +1,159 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+/*
+ * The layout of objects and the allocator underneath the constructors
+ * in bootstrap.h, for code outside bootstrap.c that needs to get at
+ * object fields directly (the vm). See the memory management section
+ * of bootstrap.c for the rules about when objects can move.
+ */
+
+#include "bootstrap.h"
+
+/* the special form a symbol introduces, if any */
+enum syntax {
+	not_syntax,
+	syn_quote,
+	syn_define,
+	syn_set,
+	syn_if,
+	syn_lambda,
+	syn_begin,
+	syn_cond,
+	syn_let,
+	syn_and,
+	syn_or,
+	syn_declare
+};
+
+/* what a node of analyzed code does, see the evaluator in bootstrap.c */
+enum node_op {
+	node_constant,
+	node_local0,
+	node_local,
+	node_set_local,
+	node_define_local,
+	node_global,
+	node_global_value,
+	node_set_global,
+	node_define_global,
+	node_if,
+	node_lambda,
+	node_sequence,
+	node_application,
+	num_node_ops /* not an op, the number of them */
+};
+
+struct object {
+	enum obj_type type;
+	int marked;
+	struct object *next; /* the free list link, or a nursery object's forwarding address */
+	union {
+		struct {
+			struct object *car;
+			struct object *cdr;
+		} pair;
+		struct {
+			char *chars;       /* NUL terminated, but can contain NULs too */
+			size_t length;
+			size_t capacity;   /* chars has room for capacity + 1 */
+		} str;
+		struct {
+			char *name;
+			struct object *value;  /* in the global enviroment, NULL if unbound */
+			uint32_t hash;
+			unsigned int len;
+			enum syntax syntax;
+		} sym;
+		struct {
+			prim_proc fn;
+			char *name;        /* the name it was defined with, for images */
+		} prim;
+		struct {
+			enum node_op op;
+			struct object *a;
+			struct object *b;
+			struct object *c;
+		} node;
+		struct {
+			struct object *env;
+			struct object *args;
+			struct object *code;
+			int frame_size;    /* slots in the frames of its calls */
+			short nreq;        /* required arguments */
+			char rest;         /* 1 if it takes a rest argument */
+		} lambda;
+		struct {
+			struct object *parent;
+			int size;
+		} frame;               /* followed by size slots, see FRAME_SLOTS; vectors too, without a parent */
+		struct {
+			int direction;
+			FILE *handle;
+			source *in;        /* what input ports read handle through */
+			char *string;      /* what a string port has written, see open_memstream */
+			size_t length;
+		} port;
+		struct {
+			void **insns;      /* threaded code for the vm */
+			int *relocs;       /* the indices of the words in insns that are objects */
+			int length;
+			int nrelocs;
+			void (*release)(struct object *code); /* frees insns and relocs, NULL if they were malloced */
+		} code;                /* always old, as insns can't be moved */
+		struct {
+			struct object *env;
+			struct object *code;
+			void **entry;      /* somewhere in code's insns */
+			int frame_size;
+			short nreq;
+			char rest;
+			char stack_frame;  /* 1 if its calls keep their frame on the vm's stack */
+			struct object *(*native)(struct object **base, int n); /* NULL unless compiled to C */
+		} closure;             /* a procedure compiled for the vm, or to C, see native/runtime.h */
+		struct {
+			uint32_t *digits;  /* the magnitude, least significant first */
+			int length;
+			int sign;          /* 1 or -1 */
+		} big;                 /* an integer too big for a fixnum, see numbers.c */
+		double flonum;
+		struct {
+			unsigned char *bytes;
+			size_t length;
+		} bytevector;
+		struct {
+			struct object *slots;     /* a vector of keys and values */
+			struct object *old_slots; /* while resizing, what's still to move */
+			uint32_t count;           /* entries */
+			uint32_t used;            /* slots with a key or a deleted key */
+			uint32_t moved;           /* old slots moved so far */
+			char kind;                /* an enum table_kind */
+			char young_keys;          /* 1 if a key hashed by address could move */
+			long epoch;               /* minor collections when it got that key */
+		} table;                      /* see tables.c */
+	} data;
+};
+
+/* check_type for heap objects, without the call */
+static inline int is_heap_type(object *obj, enum obj_type type)
+{
+	return !is_immediate(obj) && obj->type == type;
+}
+
+/* the slots of a frame come straight after its header */
+#define FRAME_SLOTS(frame) ((object **) ((frame) + 1))
+
+object *alloc_obj(enum obj_type type);
+object *alloc_old(enum obj_type type);
+object *alloc_frame(int size); /* the slots are left uninitialised */
+
+/* must be called before storing new in obj, unless obj was just allocated */
+void write_barrier(object *obj, object *new);
+
+/* 1 if obj is in the nursery, so the next collection will move it */
+int is_young(object *obj);
+
+/* collects if the nursery is nearly full, see gc_protect */
+void gc_safe_point(void);
+
+#endif /*include guard*/
@@ -2,6 +2,7 @@
  * Primitive procedures for the bootstrap scheme interpreter
  */
 
+#define _GNU_SOURCE /* for memmem */
 #include <stdlib.h>
 #include <string.h>
 #include "bootstrap.h"
@@ -13,23 +14,36 @@
   	return make_bool(check_type(scm_ ## type, car(args), 0)); \
  }
 
-DEF_TYPE_PRED(bool);
-DEF_TYPE_PRED(char);
-DEF_TYPE_PRED(int);
+/*immediates only need a bit test*/
+#define DEF_IMM_PRED(type, test) static object *is_ ## type ## _proc(object *args) \
+ { \
+  	return make_bool(test(car(args))); \
+ }
+
+#define is_eof_object(x) ((x) == eof)
+
+DEF_IMM_PRED(bool, is_bool);
+DEF_IMM_PRED(char, is_char);
+DEF_IMM_PRED(int, is_integer);
+DEF_IMM_PRED(number, is_number);
 DEF_TYPE_PRED(pair);
 DEF_TYPE_PRED(symbol);
 DEF_TYPE_PRED(file);
-DEF_TYPE_PRED(eof);
+DEF_IMM_PRED(eof, is_eof_object);
 /*
 DEF_TYPE_PRED(prim_fun);
 DEF_TYPE_PRED(lambda);
 */
 DEF_TYPE_PRED(str);
+DEF_TYPE_PRED(vector);
+DEF_TYPE_PRED(bytevector);
+DEF_TYPE_PRED(table);
 
 static object *is_proc_proc(object *args) /*a proc that checks if it's arg is a proc, hence proc twice*/
 {
 	return make_bool(check_type(scm_prim_fun, car(args), 0) ||
-		check_type(scm_lambda, car(args), 0));
+		check_type(scm_lambda, car(args), 0) ||
+		check_type(scm_closure, car(args), 0));
 }
 
 /*conversions*/
@@ -53,15 +67,24 @@ static object *symbol_2string_proc(object *args)
 
 static object *number_2string_proc(object *args)
 {
-	return make_str(int_to_string(obj2int(args)));
+	char *str = number_to_string(car(args), cdr(args) == empty_list ? 10 : obj2int(cadr(args)));
+	object *obj = make_str(str);
+	free(str);
+	return obj;
 }
 static object *string_2number_proc(object *args)
 {
-	char *str = obj2str(car(args));
-	char *end;
-	int num = (int)strtol(str, &end, cdr(args) == empty_list ? 10 : obj2int(cadr(args)));
-	if(end == str) return false;
-	else return make_int(num);
+	object *num = string_to_number(obj2str(car(args)), 
+		cdr(args) == empty_list ? 10 : obj2int(cadr(args)));
+	return num == NULL ? false : num;
+}
+static object *exact_2inexact_proc(object *args)
+{
+	return exact_to_inexact(car(args));
+}
+static object *inexact_2exact_proc(object *args)
+{
+	return inexact_to_exact(car(args));
 }
 
 /*lists*/
@@ -85,76 +108,265 @@ static object *set_cdr_proc(object *args)
 	return(get_symbol("OK"));
 }
 
+/* caar to cddddr, see cxrs.sh */
+#define DEF_CXR_PROC(name) static object *name ## _proc(object *args){return name(car(args));}
+CXRS(DEF_CXR_PROC)
+
+static object *is_null_proc(object *args)
+{
+	return make_bool(car(args) == empty_list);
+}
+
+static object *list_proc(object *args)
+{
+	return args;
+}
+
+/* where a walk down list stopped, which has to be the empty list */
+static void check_list_end(object *end, object *list)
+{
+	if (end != empty_list)
+		eval_err("Not a list:", list);
+}
+
+static object *length_proc(object *args)
+{
+	object *list;
+	intptr_t length = 0;
+
+	for (list = car(args); check_type(scm_pair, list, 0); list = cdr(list))
+		length++;
+	check_list_end(list, car(args));
+	return make_int(length);
+}
+
+/* copies every list but the last, which the result ends with */
+static object *append_proc(object *args)
+{
+	object *result = empty_list, *last = NULL, *list, *next;
+
+	if (args == empty_list)
+		return empty_list;
+	for (; cdr(args) != empty_list; args = cdr(args)){
+		for (list = car(args); check_type(scm_pair, list, 0); list = cdr(list)){
+			next = cons(car(list), empty_list);
+			if (last == NULL)
+				result = next;
+			else
+				set_cdr(last, next);
+			last = next;
+		}
+		check_list_end(list, car(args));
+	}
+	if (last == NULL)
+		return car(args);
+	set_cdr(last, car(args));
+	return result;
+}
+
+static object *reverse_proc(object *args)
+{
+	object *list, *result = empty_list;
+
+	for (list = car(args); check_type(scm_pair, list, 0); list = cdr(list))
+		result = cons(car(list), result);
+	check_list_end(list, car(args));
+	return result;
+}
+
+/* (range lo hi) the integers from lo up to but not including hi */
+static object *range_proc(object *args)
+{
+	intptr_t lo = obj2int(car(args)), hi = obj2int(cadr(args));
+	object *list = empty_list;
+
+	while (hi > lo)
+		list = cons(make_int(--hi), list);
+	return list;
+}
+
+static object *memq_proc(object *args)
+{
+	object *list;
+
+	for (list = cadr(args); check_type(scm_pair, list, 0); list = cdr(list))
+		if (car(list) == car(args))
+			return list;
+	check_list_end(list, cadr(args));
+	return false;
+}
+
+static object *assq_proc(object *args)
+{
+	object *list;
+
+	for (list = cadr(args); check_type(scm_pair, list, 0); list = cdr(list))
+		if (caar(list) == car(args))
+			return car(list);
+	check_list_end(list, cadr(args));
+	return false;
+}
+
+/*
+ * map and for-each call a procedure, so unlike the other primitives
+ * they can run the collector, and protect what they hold across calls.
+ */
+
+/* the cars of lists, moving each list on, or NULL once one runs out */
+static object *next_arguments(object *lists)
+{
+	object *args = empty_list, *last = NULL, *next;
+
+	if (lists == empty_list)
+		return NULL;
+	for (; lists != empty_list; lists = cdr(lists)){
+		if (!check_type(scm_pair, car(lists), 0)){
+			check_list_end(car(lists), car(lists));
+			return NULL;
+		}
+		next = cons(caar(lists), empty_list);
+		if (last == NULL)
+			args = next;
+		else
+			set_cdr(last, next);
+		last = next;
+		set_car(lists, cdar(lists));
+	}
+	return args;
+}
+
+/* calls car(args) on the elements of the lists after it, and keeps the results if map */
+static object *map_lists(object *args, int map)
+{
+	object *f = car(args), *lists, *results = empty_list, *val, *next;
+	int depth = gc_depth();
+
+	lists = append_proc(cons(cdr(args), cons(empty_list, empty_list))); /* it's changed */
+	gc_protect(&f);
+	gc_protect(&lists);
+	gc_protect(&results);
+	while ((args = next_arguments(lists)) != NULL){
+		val = apply(f, args);
+		if (map)
+			results = cons(val, results);
+	}
+	gc_release(depth);
+	if (!map)
+		return true;
+
+	/* reverse the results in place */
+	for (val = empty_list; results != empty_list; results = next){
+		next = cdr(results);
+		set_cdr(results, val);
+		val = results;
+	}
+	return val;
+}
+
+static object *map_proc(object *args)
+{
+	return map_lists(args, 1);
+}
+
+static object *for_each_proc(object *args)
+{
+	return map_lists(args, 0);
+}
+
 /*arithmetic*/
 static object *add_proc(object *args)
 {
-	int sum = 0;
+	object *sum = make_int(0);
 	for(; args != empty_list; args = cdr(args))
-		sum += obj2int(car(args));
+		sum = num_add(sum, car(args));
 
-	return make_int(sum);
+	return sum;
 }
 
 static object *mul_proc(object *args)
 {
-	int prod;
-	for(prod = 1; args != empty_list; args = cdr(args))
-		prod *= obj2int(car(args));
+	object *prod = make_int(1);
+	for(; args != empty_list; args = cdr(args))
+		prod = num_mul(prod, car(args));
 
-	return make_int(prod);
+	return prod;
 }
 
 static object *sub_proc(object *args)
 {
-	int sofar;
+	object *sofar;
+	if(cdr(args) == empty_list)
+		return num_sub(make_int(0), car(args));
+
+	for(sofar = car(args), args = cdr(args); args != empty_list; args = cdr(args))
+		sofar = num_sub(sofar, car(args));
+
+	return sofar;
+}
+
+static object *div_proc(object *args)
+{
+	object *sofar;
 	if(cdr(args) == empty_list)
-		return make_int(-obj2int(car(args)));
+		return num_divide(make_int(1), car(args));
 
-	for(sofar = obj2int(car(args)), args = cdr(args); args != empty_list; args = cdr(args))
-		sofar -= obj2int(car(args));
+	for(sofar = car(args), args = cdr(args); args != empty_list; args = cdr(args))
+		sofar = num_divide(sofar, car(args));
 
-	return make_int(sofar);
+	return sofar;
 }
 
 static object *quotient_proc(object *args)
 {
-	return make_int(obj2int(car(args)) / obj2int(cadr(args)));
+	return num_quotient(car(args), cadr(args));
 }
 static object *remainder_proc(object *args)
 {
-	return make_int(obj2int(car(args)) % obj2int(cadr(args)));
+	return num_remainder(car(args), cadr(args));
 }
-
-static object *equals_proc(object *args)
+static object *modulo_proc(object *args)
 {
-	int first = obj2int(car(args));
-	for(args = cdr(args); args != empty_list; args = cdr(args))
-		if(obj2int(car(args)) != first)
-			return false;
-
-	return true;
+	return num_modulo(car(args), cadr(args));
 }
 
-static object *greater_than_proc(object *args)
+/* 
+ * The comparisons check each neighbouring pair, as comparing exact and
+ * inexact numbers isn't transitive otherwise. test is what the results
+ * of num_compare that mean true add up to, as bits: 1 for less, 2 for
+ * equal and 4 for greater. A NaN compares as 2, which matches nothing.
+ */
+static object *compare(object *args, int test)
 {
-	int big = obj2int(car(args));
+	object *a = car(args);
+	int c;
 	for(args = cdr(args); args != empty_list; args = cdr(args)){
-		if(big > obj2int(car(args)))
-			big = obj2int(car(args));
-		else return false;
+		c = num_compare(a, car(args));
+		if(c == 2 || !(test & (1 << (c + 1))))
+			return false;
+		a = car(args);
 	}
+	if(!is_number(a))
+		eval_err("Not a number:", a);
 	return true;
 }
 
-static object *less_than_proc(object *args)
+static object *equals_proc(object *args){return compare(args, 2);}
+static object *less_than_proc(object *args){return compare(args, 1);}
+static object *greater_than_proc(object *args){return compare(args, 4);}
+static object *less_or_equal_proc(object *args){return compare(args, 1 | 2);}
+static object *greater_or_equal_proc(object *args){return compare(args, 2 | 4);}
+
+static object *is_exact_proc(object *args)
 {
-	int small = obj2int(car(args));
-	for(args = cdr(args); args != empty_list; args = cdr(args)){
-		if(small < obj2int(car(args)))
-			small = obj2int(car(args));
-		else return false;
-	}
-	return true;
+	if(!is_number(car(args)))
+		eval_err("Not a number:", car(args));
+	return make_bool(is_exact_integer(car(args)));
+}
+static object *is_inexact_proc(object *args)
+{
+	if(!is_number(car(args)))
+		eval_err("Not a number:", car(args));
+	return make_bool(!is_exact_integer(car(args)));
 }
 
 /*enviroments*/
@@ -185,15 +397,15 @@ static object *open_input_file_proc(object *args)
 	return make_port(in, 1);
 }
 
-static FILE *optional_input_port(object *args)
+static source *optional_input_port(object *args)
 {
-	FILE *in;
+	source *in;
 	if(args == empty_list) 
-		in = stdin;
+		in = stdin_source;
 	else{
 		if (!port_direction(car(args)))
 			eval_err("Not an input port:", car(args));
-		else in = port_handle(car(args));
+		else in = port_source(car(args));
 	}
 	if (in == NULL)
 		eval_err("File has been closed:", car(args));
@@ -202,14 +414,14 @@ static FILE *optional_input_port(object *args)
 
 static object *read_char_proc(object *args)
 {
-	int c = getc(optional_input_port(args));
+	int c = source_getc(optional_input_port(args));
 	if (c == EOF) return eof;
 	else return make_char(c);
 }
 
 static object *unread_char_proc(object *args)
 {
-	ungetc(obj2char(car(args)), optional_input_port(cdr(args)));
+	unget_source(optional_input_port(cdr(args)), obj2char(car(args)));
 	return get_symbol("OK");
 }
 
@@ -221,26 +433,32 @@ static object *is_input_port_proc(object *args)
 static object *close_file_proc(object *args)
 {
 	if(port_handle(car(args)) == NULL) return get_symbol("ALREADY-CLOSED");
-	fclose(port_handle(car(args)));
+	if (port_source(car(args)) != NULL)
+		close_source(port_source(car(args)));
+	else fclose(port_handle(car(args)));
 	set_port_handle_to_null(car(args));
 	return get_symbol("OK");
 }
 
 static object *read_proc(object *args)
 {
-	return read(optional_input_port(args));
+	return read_datum(optional_input_port(args));
 }
 
 static object *load_proc(object *args)
 {
-	FILE *in = fopen(obj2str(car(args)), "r");
+	FILE *file = fopen(obj2str(car(args)), "r");
+	source *in;
 	object *expr;
-	if (in == NULL)
+	if (file == NULL)
 		eval_err("Could not load", car(args));
-	while((expr = read(in)) != eof){
+	in = open_source(file);
+	while((expr = read_datum(in)) != eof){
 		print(stdout, eval(expr, global_enviroment), 1);
 		fputc('\n', stdout);
 	}
+	close_source(in);
+	gc_trim(); /* give back the chunks the load's garbage was in */
 	return get_symbol("PROGRAM-LOADED");
 }
 
@@ -256,6 +474,16 @@ static object *open_output_file_proc(object *args)
 	return make_port(out, 0);
 }
 
+static object *open_output_string_proc(object *args)
+{
+	return make_string_port();
+}
+
+static object *get_output_string_proc(object *args)
+{
+	return string_port_contents(car(args));
+}
+
 static FILE *optional_output_port(object *args)
 {
 	FILE *out;
@@ -295,22 +523,369 @@ static object *display_proc(object *args)
 }
 
 /*Strings & characters*/
+
+/* 
+ * Strings know their length, so these work on the characters with
+ * memcpy, memcmp, memchr and memmem, which the C library scans a vector
+ * register at a time, rather than a character at a time in scheme.
+ */
+
+/* sizes the result first, so each string is copied once */
 static object *string_append_proc(object *args)
 {
-	char *str = str_append(obj2str(car(args)), obj2str(cadr(args)));
-	object *ret;
-
-	if(str == NULL)
-		eval_err("Out of memory", args);
+	size_t length = 0;
+	object *str, *rest;
+	char *p;
+
+	for (rest = args; rest != empty_list; rest = cdr(rest))
+		length += str_length(car(rest));
+	str = make_str_len(NULL, length);
+	for (p = obj2str(str); args != empty_list; args = cdr(args)){
+		memcpy(p, obj2str(car(args)), str_length(car(args)));
+		p += str_length(car(args));
+	}
+	return str;
+}
 
-	ret = make_str(str);
-	free(str);
-	return ret;
+/* (string-append! str more ...) appends to str itself, in amortised constant time */
+static object *string_append_bang_proc(object *args)
+{
+	object *str = car(args);
+	for (args = cdr(args); args != empty_list; args = cdr(args))
+		str_append_str(str, car(args));
+	check_type(scm_str, str, 1);
+	return str;
 }
 
 static object *string_length_proc(object *args)
 {
-	return make_int(strlen(obj2str(car(args))));
+	return make_int(str_length(car(args)));
+}
+
+/* an index into str from 0 to its length, or error */
+static size_t string_index_arg(object *str, object *index)
+{
+	intptr_t k = obj2int(index);
+	if (k < 0 || k > str_length(str))
+		eval_err("Index out of range:", index);
+	return k;
+}
+
+static object *string_ref_proc(object *args)
+{
+	size_t k = string_index_arg(car(args), cadr(args));
+	if (k == str_length(car(args)))
+		eval_err("Index out of range:", cadr(args));
+	return make_char(obj2str(car(args))[k]);
+}
+
+/* (substring str start [end]) */
+static object *substring_proc(object *args)
+{
+	object *str = car(args);
+	size_t start = string_index_arg(str, cadr(args));
+	size_t end = cddr(args) == empty_list ? str_length(str) : string_index_arg(str, caddr(args));
+
+	if (end < start)
+		eval_err("Index out of range:", caddr(args));
+	return make_str_len(obj2str(str) + start, end - start);
+}
+
+/* like memcmp, with a shorter string that's a prefix of a longer one less */
+static int compare_strings(object *a, object *b)
+{
+	size_t len_a = str_length(a), len_b = str_length(b);
+	int c = memcmp(obj2str(a), obj2str(b), len_a < len_b ? len_a : len_b);
+	if (c != 0)
+		return c < 0 ? -1 : 1;
+	return (len_a > len_b) - (len_a < len_b);
+}
+
+/* test is as for compare */
+static object *compare_strings_in(object *args, int test)
+{
+	object *a = car(args);
+	for (args = cdr(args); args != empty_list; args = cdr(args)){
+		if (!(test & (1 << (compare_strings(a, car(args)) + 1))))
+			return false;
+		a = car(args);
+	}
+	check_type(scm_str, a, 1);
+	return true;
+}
+
+static object *string_equals_proc(object *args)
+{
+	object *a = car(args);
+	for (args = cdr(args); args != empty_list; args = cdr(args)){
+		if (str_length(a) != str_length(car(args))
+			|| memcmp(obj2str(a), obj2str(car(args)), str_length(a)) != 0)
+			return false;
+		a = car(args);
+	}
+	check_type(scm_str, a, 1);
+	return true;
+}
+
+static object *string_less_than_proc(object *args){return compare_strings_in(args, 1);}
+static object *string_greater_than_proc(object *args){return compare_strings_in(args, 4);}
+static object *string_less_or_equal_proc(object *args){return compare_strings_in(args, 1 | 2);}
+static object *string_greater_or_equal_proc(object *args){return compare_strings_in(args, 2 | 4);}
+
+/* (string-index str char [start]), the index of the first char from start, or #f */
+static object *string_index_proc(object *args)
+{
+	object *str = car(args);
+	size_t start = cddr(args) == empty_list ? 0 : string_index_arg(str, caddr(args));
+	char *found = memchr(obj2str(str) + start, obj2char(cadr(args)), str_length(str) - start);
+
+	return found == NULL ? false : make_int(found - obj2str(str));
+}
+
+/* (string-search pattern str [start]), where pattern first appears from start, or #f */
+static object *string_search_proc(object *args)
+{
+	object *pattern = car(args), *str = cadr(args);
+	size_t start = cddr(args) == empty_list ? 0 : string_index_arg(str, caddr(args));
+	char *found = memmem(obj2str(str) + start, str_length(str) - start, 
+	                     obj2str(pattern), str_length(pattern));
+
+	return found == NULL ? false : make_int(found - obj2str(str));
+}
+
+/* (string-split str char), the strings between the chars, empty ones included */
+static object *string_split_proc(object *args)
+{
+	object *str = car(args), *list, *last, *next;
+	char c = obj2char(cadr(args));
+	char *start = obj2str(str), *end = start + str_length(str), *found;
+
+	/* nothing is collected in a primitive, so list needn't be protected */
+	list = last = cons(false, empty_list);
+	for (;;){
+		found = memchr(start, c, end - start);
+		next = cons(make_str_len(start, (found == NULL ? end : found) - start), empty_list);
+		set_cdr(last, next);
+		last = next;
+		if (found == NULL)
+			return cdr(list);
+		start = found + 1;
+	}
+}
+
+/*vectors & bytevectors*/
+
+/* an optional index argument from 0 to length */
+static size_t optional_index(object *args, size_t otherwise, size_t length)
+{
+	intptr_t k;
+	if (args == empty_list)
+		return otherwise;
+	k = obj2int(car(args));
+	if (k < 0 || k > length)
+		eval_err("Index out of range:", car(args));
+	return k;
+}
+
+/* a length, for make-vector and make-bytevector */
+static size_t length_arg(object *obj)
+{
+	if (obj2int(obj) < 0)
+		eval_err("Bad length:", obj);
+	return obj2int(obj);
+}
+
+static object *make_vector_proc(object *args)
+{
+	return make_vector(length_arg(car(args)), cdr(args) == empty_list ? false : cadr(args));
+}
+
+static object *vector_proc(object *args)
+{
+	return list_to_vector(args);
+}
+
+static object *vector_length_proc(object *args)
+{
+	return make_int(vector_length(car(args)));
+}
+
+static object *vector_ref_proc(object *args)
+{
+	return vector_ref(car(args), cadr(args));
+}
+
+static object *vector_set_proc(object *args)
+{
+	vector_set(car(args), cadr(args), caddr(args));
+	return get_symbol("OK");
+}
+
+/* (vector-fill! vector fill [start [end]]) */
+static object *vector_fill_proc(object *args)
+{
+	size_t length = vector_length(car(args));
+	size_t start = optional_index(cddr(args), 0, length);
+	size_t end = cddr(args) == empty_list ? length : optional_index(cdddr(args), length, length);
+
+	vector_fill(car(args), cadr(args), start, end);
+	return get_symbol("OK");
+}
+
+/* (vector->list vector [start [end]]) */
+static object *vector_2list_proc(object *args)
+{
+	size_t length = vector_length(car(args));
+	size_t start = optional_index(cdr(args), 0, length);
+	size_t end = cdr(args) == empty_list ? length : optional_index(cddr(args), length, length);
+
+	return vector_to_list(car(args), start, end);
+}
+
+static object *list_2vector_proc(object *args)
+{
+	return list_to_vector(car(args));
+}
+
+static object *make_bytevector_proc(object *args)
+{
+	return make_bytevector(length_arg(car(args)), cdr(args) == empty_list ? 0 : obj2byte(cadr(args)));
+}
+
+static object *bytevector_proc(object *args)
+{
+	return list_to_bytevector(args);
+}
+
+static object *bytevector_length_proc(object *args)
+{
+	return make_int(bytevector_length(car(args)));
+}
+
+static size_t bytevector_index(object *bytevector, object *index)
+{
+	intptr_t k = obj2int(index);
+	if (k < 0 || k >= bytevector_length(bytevector))
+		eval_err("Index out of range:", index);
+	return k;
+}
+
+static object *bytevector_u8_ref_proc(object *args)
+{
+	return make_int(bytevector_bytes(car(args))[bytevector_index(car(args), cadr(args))]);
+}
+
+static object *bytevector_u8_set_proc(object *args)
+{
+	bytevector_bytes(car(args))[bytevector_index(car(args), cadr(args))] = obj2byte(caddr(args));
+	return get_symbol("OK");
+}
+
+/*hash tables, see tables.c; hash-table-update! and hash-table-walk are in lib.scm*/
+
+/* (make-hash-table [kind]), kind being eq (the default), eqv or string */
+static object *make_hash_table_proc(object *args)
+{
+	object *kind = args == empty_list ? get_symbol("EQ") : car(args);
+
+	if (kind == get_symbol("EQ"))
+		return make_table(table_eq);
+	if (kind == get_symbol("EQV"))
+		return make_table(table_eqv);
+	if (kind == get_symbol("STRING"))
+		return make_table(table_string);
+	eval_err("Not a kind of hash table:", kind);
+}
+
+/* (hash-table-ref table key [default]), an error if it's missing without a default */
+static object *hash_table_ref_proc(object *args)
+{
+	object *value = table_ref(car(args), cadr(args));
+
+	if (value != NULL)
+		return value;
+	if (cddr(args) == empty_list)
+		eval_err("Not in the hash table:", cadr(args));
+	return caddr(args);
+}
+
+static object *hash_table_set_proc(object *args)
+{
+	table_set(car(args), cadr(args), caddr(args));
+	return get_symbol("OK");
+}
+
+static object *hash_table_delete_proc(object *args)
+{
+	return make_bool(table_delete(car(args), cadr(args)));
+}
+
+static object *hash_table_contains_proc(object *args)
+{
+	return make_bool(table_ref(car(args), cadr(args)) != NULL);
+}
+
+static object *hash_table_count_proc(object *args)
+{
+	return make_int(table_count(car(args)));
+}
+
+static object *hash_table_keys_proc(object *args)
+{
+	return table_entries(car(args), table_keys);
+}
+
+static object *hash_table_values_proc(object *args)
+{
+	return table_entries(car(args), table_values);
+}
+
+static object *hash_table_2alist_proc(object *args)
+{
+	return table_entries(car(args), table_pairs);
+}
+
+static object *hash_table_clear_proc(object *args)
+{
+	table_clear(car(args));
+	return get_symbol("OK");
+}
+
+/* 
+ * update! and walk call a procedure, so they protect what they hold
+ * across it, as map does
+ */
+
+/* (hash-table-update! table key proc [default]) sets key's value to proc of its old value, or of default */
+static object *hash_table_update_proc(object *args)
+{
+	object *value = table_ref(car(args), cadr(args));
+	int depth = gc_depth();
+
+	if (value == NULL){
+		if (cdddr(args) == empty_list)
+			eval_err("Not in the hash table:", cadr(args));
+		value = cadddr(args);
+	}
+	gc_protect(&args);
+	value = apply(caddr(args), cons(value, empty_list));
+	gc_release(depth);
+	table_set(car(args), cadr(args), value);
+	return get_symbol("OK");
+}
+
+/* (hash-table-walk table proc) calls proc with each key and value there were to begin with */
+static object *hash_table_walk_proc(object *args)
+{
+	object *proc = cadr(args), *entries = table_entries(car(args), table_pairs);
+	int depth = gc_depth();
+
+	gc_protect(&proc);
+	gc_protect(&entries);
+	for (; entries != empty_list; entries = cdr(entries))
+		apply(proc, cons(caar(entries), cons(cdar(entries), empty_list)));
+	gc_release(depth);
+	return true;
 }
 
 /*misc*/
@@ -324,6 +899,11 @@ static object *eq_proc(object *args)
 	return make_bool(car(args) == cadr(args));
 }
 
+static object *not_proc(object *args)
+{
+	return make_bool(car(args) == false);
+}
+
 static object *gensym_proc(object *args)
 {
 	static count = 1;
@@ -356,6 +936,37 @@ static object *error_proc(object *args)
 	exit(1);
 }
 
+static object *gc_proc(object *ignore)
+{
+	gc_collect();
+	return get_symbol("OK");
+}
+
+/* returns an alist of the allocation counters */
+static object *gc_stats_proc(object *ignore)
+{
+	struct gc_stats *stats = gc_statistics();
+	object *result = empty_list;
+#define STAT(name, field) \
+	result = cons(cons(get_symbol(name), make_int(stats->field)), result)
+
+	STAT("LIVE", live);
+	STAT("CHUNKS", chunks);
+	STAT("MAJOR-COLLECTIONS", major_collections);
+	STAT("MINOR-COLLECTIONS", minor_collections);
+	STAT("PROMOTED", promoted);
+	STAT("OLD-ALLOCATIONS", old_allocs);
+	STAT("ALLOCATIONS", allocs);
+	return result;
+#undef STAT
+}
+
+static object *save_image_proc(object *args)
+{
+	save_image(obj2str(car(args)));
+	return get_symbol("OK");
+}
+
 static object *system_proc(object *args)
 {
 	return(make_int(system(obj2str(car(args)))));
@@ -382,39 +993,67 @@ static object *to_sym(char *str)
 }
 
 
-#define DEFPROC(n, f) \
-	define_var(to_sym(#n), make_prim_fun(f ## _proc), env)
+static void define_prim(object *sym, prim_proc fun, object *env)
+{
+	define_var(sym, make_prim_fun(fun, sym2str(sym)), env);
+}
+
+#define DEFPROC(n, f) define_prim(to_sym(#n), f ## _proc, env)
 #define DEFPROC1(n) DEFPROC(n, n)
 void init_enviroment(object *env)
 {
 	DEFPROC(+, add);
 	DEFPROC(*, mul);
 	DEFPROC(-, sub);
+	DEFPROC(/, div);
 	DEFPROC1(quotient);
 	DEFPROC1(remainder);
+	DEFPROC1(modulo);
 	DEFPROC(=, equals);
 	DEFPROC(>, greater_than);
 	DEFPROC(<, less_than);
+	DEFPROC(>=, greater_or_equal);
+	DEFPROC(<=, less_or_equal);
 
 	DEFPROC1(car);
 	DEFPROC1(cdr);
 	DEFPROC1(cons);
 	DEFPROC(set_car!, set_car);
 	DEFPROC(set_cdr!, set_cdr);
+#define DEFCXR(name) DEFPROC1(name);
+	CXRS(DEFCXR)
+	DEFPROC(null?, is_null);
+	DEFPROC1(list);
+	DEFPROC1(length);
+	DEFPROC1(append);
+	DEFPROC1(reverse);
+	DEFPROC1(range);
+	DEFPROC1(memq);
+	DEFPROC1(assq);
+	DEFPROC1(map);
+	DEFPROC(for-each, for_each);
 
 	DEFPROC(boolean?, is_bool);
 	DEFPROC(char?, is_char);
 	DEFPROC(integer?, is_int);
+	DEFPROC(number?, is_number);
+	DEFPROC(exact?, is_exact);
+	DEFPROC(inexact?, is_inexact);
 	DEFPROC(pair?, is_pair);
 	DEFPROC(symbol?, is_symbol);
 	DEFPROC(procedure?, is_proc);
 	DEFPROC(string?, is_str);
+	DEFPROC(vector?, is_vector);
+	DEFPROC(bytevector?, is_bytevector);
+	DEFPROC(hash_table?, is_table);
 	DEFPROC(port?, is_file);
 	DEFPROC(eof_object?, is_eof);
 
 	DEFPROC1(integer_2char);
 	DEFPROC1(char_2integer);
 	DEFPROC1(number_2string);
+	DEFPROC1(exact_2inexact);
+	DEFPROC1(inexact_2exact);
 	DEFPROC1(string_2number);
 	DEFPROC1(string_2symbol);
 	DEFPROC1(symbol_2string);
@@ -433,21 +1072,65 @@ void init_enviroment(object *env)
 
 	DEFPROC1(open_output_file);
 	DEFPROC(close_output_file, close_file);
+	DEFPROC1(open_output_string);
+	DEFPROC1(get_output_string);
 	DEFPROC1(write_char);
 	DEFPROC(output_port?, is_output_port);
 	DEFPROC1(write);
 	DEFPROC1(display);
 
 	DEFPROC1(string_append);
+	DEFPROC(string_append!, string_append_bang);
 	DEFPROC1(string_length);
+	DEFPROC1(string_ref);
+	DEFPROC1(substring);
+	DEFPROC(string=?, string_equals);
+	DEFPROC(string<?, string_less_than);
+	DEFPROC(string>?, string_greater_than);
+	DEFPROC(string<=?, string_less_or_equal);
+	DEFPROC(string>=?, string_greater_or_equal);
+	DEFPROC1(string_index);
+	DEFPROC1(string_search);
+	DEFPROC1(string_split);
+
+	DEFPROC1(make_vector);
+	DEFPROC1(vector);
+	DEFPROC1(vector_length);
+	DEFPROC1(vector_ref);
+	DEFPROC(vector_set!, vector_set);
+	DEFPROC(vector_fill!, vector_fill);
+	DEFPROC1(vector_2list);
+	DEFPROC1(list_2vector);
+	DEFPROC1(make_bytevector);
+	DEFPROC1(bytevector);
+	DEFPROC1(bytevector_length);
+	DEFPROC1(bytevector_u8_ref);
+	DEFPROC(bytevector_u8_set!, bytevector_u8_set);
+
+	DEFPROC1(make_hash_table);
+	DEFPROC1(hash_table_ref);
+	DEFPROC(hash_table_set!, hash_table_set);
+	DEFPROC(hash_table_delete!, hash_table_delete);
+	DEFPROC(hash_table_contains?, hash_table_contains);
+	DEFPROC1(hash_table_count);
+	DEFPROC1(hash_table_keys);
+	DEFPROC1(hash_table_values);
+	DEFPROC1(hash_table_2alist);
+	DEFPROC(hash_table_clear!, hash_table_clear);
+	DEFPROC(hash_table_update!, hash_table_update);
+	DEFPROC1(hash_table_walk);
 
 	DEFPROC1(exit);
 	DEFPROC(eq?, eq);
+	DEFPROC1(not);
 	DEFPROC1(apply);
 	DEFPROC1(eval);
 	DEFPROC1(error);
 	DEFPROC1(system);
 	DEFPROC1(gensym);
+	DEFPROC1(gc);
+	DEFPROC1(gc_stats);
+	DEFPROC1(save_image);
 }
 
 /*syntaxes*/
@@ -491,7 +1174,7 @@ object *cond2nested_if(object *cond)
 	if (cadadr(cond) == get_symbol("=>"))
 		return list(3, get_symbol("LET"), list(1, list(2, gensym, caadr(cond))),
 						list(4, get_symbol("IF"), gensym, 
-												  list(2, car(cadadr(cond)), gensym),
+												  list(2, car(cddadr(cond)), gensym),
 												  smaller_cond));
 
 	return list(4, get_symbol("IF"), caadr(cond), 
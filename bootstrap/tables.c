@@ -0,0 +1,315 @@
+/*
+ * Hash tables, keyed by eq?, by eqv? or by the contents of strings.
+ *
+ * A table keeps its entries in a vector, a key slot then a value slot,
+ * and finds them by open addressing with linear probing. An empty slot
+ * has a NULL key, and a deleted one the key below, so that probing
+ * carries on past it. The vector is never more than half used.
+ *
+ * When it fills up the table gets a bigger vector but keeps the old one,
+ * and each operation after that moves a few entries across, so no one
+ * operation pays for copying the whole table. Until they've all moved a
+ * key can be in either vector, so lookups look in both.
+ *
+ * Symbols are hashed by their names' hash, numbers (in eqv and string
+ * tables) by value and strings (in string tables) by their characters,
+ * so none of those need to be rehashed. Anything else is hashed by its
+ * address, and young objects move when the collector promotes them. So
+ * a table notes when it's given a key that's still in the nursery, and
+ * if there has been a minor collection since then, rehashes everything
+ * before it next looks anything up. Old objects never move, so a table
+ * with only old keys never needs to. Nothing here collects.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bootstrap.h"
+#include "object.h"
+
+/* a constant that isn't any scheme value, see bootstrap.h */
+#define deleted ((object *) 0x26)
+
+#define MIN_CAPACITY 8
+#define MOVE_STEP 8     /* old slots moved across per operation while resizing */
+
+#define KEY(slots, i) (FRAME_SLOTS(slots)[2 * (i)])
+#define VALUE(slots, i) (FRAME_SLOTS(slots)[2 * (i) + 1])
+#define CAPACITY(slots) ((size_t) (slots)->data.frame.size / 2)
+
+static inline uint32_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (uint32_t) h;
+}
+
+static uint32_t hash_bytes(const unsigned char *p, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	while (length--)
+		hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+/* notes young address hashed keys if insert is set */
+static uint32_t hash_key(object *table, object *key, int insert)
+{
+	if (is_immediate(key))
+		return mix((uintptr_t) key);
+
+	switch (key->type){
+	case scm_symbol:
+		return key->data.sym.hash;
+	case scm_str:
+		if (table->data.table.kind == table_string)
+			return hash_bytes((unsigned char *) key->data.str.chars, key->data.str.length);
+		break;
+	case scm_flonum:
+		if (table->data.table.kind != table_eq)
+			return hash_bytes((unsigned char *) &key->data.flonum, sizeof(double));
+		break;
+	case scm_bignum:
+		if (table->data.table.kind != table_eq)
+			return hash_bytes((unsigned char *) key->data.big.digits,
+			                  key->data.big.length * sizeof(uint32_t)) ^ key->data.big.sign;
+		break;
+	default:
+		break;
+	}
+
+	if (insert && !table->data.table.young_keys && is_young(key)){
+		table->data.table.young_keys = 1;
+		table->data.table.epoch = gc_statistics()->minor_collections;
+	}
+	return mix((uintptr_t) key);
+}
+
+static int same_key(object *table, object *a, object *b)
+{
+	if (a == b)
+		return 1;
+	if (is_immediate(a) || is_immediate(b) || a->type != b->type
+		|| table->data.table.kind == table_eq)
+		return 0;
+
+	switch (a->type){
+	case scm_str:
+		return table->data.table.kind == table_string
+			&& a->data.str.length == b->data.str.length
+			&& memcmp(a->data.str.chars, b->data.str.chars, a->data.str.length) == 0;
+	case scm_flonum: /* eqv? compares bits, so 0.0 isn't -0.0 */
+		return memcmp(&a->data.flonum, &b->data.flonum, sizeof(double)) == 0;
+	case scm_bignum:
+		return compare_numbers(a, b) == 0;
+	default:
+		return 0;
+	}
+}
+
+/* the index of key in slots, or -1 */
+static long find(object *table, object *slots, object *key, uint32_t hash)
+{
+	size_t mask = CAPACITY(slots) - 1, i;
+	object *k;
+
+	for (i = hash & mask; (k = KEY(slots, i)) != NULL; i = (i + 1) & mask)
+		if (k != deleted && same_key(table, k, key))
+			return i;
+	return -1;
+}
+
+/* key mustn't be in slots already */
+static void insert(object *table, object *key, object *value, uint32_t hash)
+{
+	object *slots = table->data.table.slots;
+	size_t mask = CAPACITY(slots) - 1, i;
+
+	for (i = hash & mask; KEY(slots, i) != NULL && KEY(slots, i) != deleted; i = (i + 1) & mask)
+		;
+	if (KEY(slots, i) == NULL)
+		table->data.table.used++;
+	write_barrier(slots, key);
+	write_barrier(slots, value);
+	KEY(slots, i) = key;
+	VALUE(slots, i) = value;
+}
+
+static object *make_slots(size_t capacity)
+{
+	return make_vector(2 * capacity, NULL);
+}
+
+/* moves up to n old slots' entries across */
+static void move_entries(object *table, size_t n)
+{
+	object *old = table->data.table.old_slots, *key;
+	size_t i;
+
+	for (i = table->data.table.moved; i < CAPACITY(old) && n > 0; i++, n--){
+		key = KEY(old, i);
+		if (key != NULL && key != deleted){
+			insert(table, key, VALUE(old, i), hash_key(table, key, 1));
+			KEY(old, i) = deleted;
+			VALUE(old, i) = NULL;
+		}
+	}
+	table->data.table.moved = i;
+	if (i == CAPACITY(old))
+		table->data.table.old_slots = NULL;
+}
+
+/* starts moving everything to new slots with room for the entries four times over */
+static void resize(object *table)
+{
+	size_t capacity = MIN_CAPACITY;
+
+	if (table->data.table.old_slots != NULL)
+		move_entries(table, CAPACITY(table->data.table.old_slots));
+	while (capacity < 4 * (table->data.table.count + 1))
+		capacity *= 2;
+
+	table->data.table.old_slots = table->data.table.slots;
+	table->data.table.slots = make_slots(capacity);
+	write_barrier(table, table->data.table.slots);
+	write_barrier(table, table->data.table.old_slots);
+	table->data.table.used = 0;
+	table->data.table.moved = 0;
+}
+
+/* rehashes everything now if a young key could have moved since it was hashed */
+static void prepare(object *table)
+{
+	check_type(scm_table, table, 1);
+	if (table->data.table.young_keys
+		&& table->data.table.epoch != gc_statistics()->minor_collections){
+		table->data.table.young_keys = 0;
+		resize(table);
+		move_entries(table, CAPACITY(table->data.table.old_slots));
+	} else if (table->data.table.old_slots != NULL)
+		move_entries(table, MOVE_STEP);
+}
+
+object *make_table(enum table_kind kind)
+{
+	object *obj = alloc_old(scm_table);
+	obj->data.table.slots = make_slots(MIN_CAPACITY);
+	write_barrier(obj, obj->data.table.slots);
+	obj->data.table.old_slots = NULL;
+	obj->data.table.count = obj->data.table.used = obj->data.table.moved = 0;
+	obj->data.table.epoch = 0;
+	obj->data.table.kind = kind;
+	obj->data.table.young_keys = 0;
+	return obj;
+}
+
+object *table_ref(object *table, object *key)
+{
+	uint32_t hash;
+	long i;
+
+	prepare(table);
+	hash = hash_key(table, key, 0);
+	if ((i = find(table, table->data.table.slots, key, hash)) >= 0)
+		return VALUE(table->data.table.slots, i);
+	if (table->data.table.old_slots != NULL
+		&& (i = find(table, table->data.table.old_slots, key, hash)) >= 0)
+		return VALUE(table->data.table.old_slots, i);
+	return NULL;
+}
+
+void table_set(object *table, object *key, object *value)
+{
+	object *slots;
+	uint32_t hash;
+	long i;
+
+	prepare(table);
+	hash = hash_key(table, key, 1);
+	slots = table->data.table.slots;
+	if ((i = find(table, slots, key, hash)) >= 0){
+		write_barrier(slots, value);
+		VALUE(slots, i) = value;
+		return;
+	}
+	if (table->data.table.old_slots != NULL
+		&& (i = find(table, table->data.table.old_slots, key, hash)) >= 0){
+		KEY(table->data.table.old_slots, i) = deleted;
+		VALUE(table->data.table.old_slots, i) = NULL;
+		table->data.table.count--;
+	}
+	if (2 * (table->data.table.used + 1) > CAPACITY(slots))
+		resize(table);
+	insert(table, key, value, hash);
+	table->data.table.count++;
+}
+
+int table_delete(object *table, object *key)
+{
+	object *slots;
+	uint32_t hash;
+	long i;
+
+	prepare(table);
+	hash = hash_key(table, key, 0);
+	slots = table->data.table.slots;
+	if ((i = find(table, slots, key, hash)) < 0){
+		slots = table->data.table.old_slots;
+		if (slots == NULL || (i = find(table, slots, key, hash)) < 0)
+			return 0;
+	}
+	KEY(slots, i) = deleted;
+	VALUE(slots, i) = NULL;
+	table->data.table.count--;
+	return 1;
+}
+
+size_t table_count(object *table)
+{
+	check_type(scm_table, table, 1);
+	return table->data.table.count;
+}
+
+static object *add_entries(object *slots, object *list, int what)
+{
+	size_t i;
+	object *key;
+
+	for (i = 0; i < CAPACITY(slots); i++){
+		key = KEY(slots, i);
+		if (key == NULL || key == deleted)
+			continue;
+		list = cons(what == table_keys ? key
+		            : what == table_values ? VALUE(slots, i)
+		            : cons(key, VALUE(slots, i)), list);
+	}
+	return list;
+}
+
+object *table_entries(object *table, enum table_entries what)
+{
+	object *list;
+
+	check_type(scm_table, table, 1);
+	list = add_entries(table->data.table.slots, empty_list, what);
+	if (table->data.table.old_slots != NULL)
+		list = add_entries(table->data.table.old_slots, list, what);
+	return list;
+}
+
+void table_clear(object *table)
+{
+	check_type(scm_table, table, 1);
+	table->data.table.slots = make_slots(MIN_CAPACITY);
+	write_barrier(table, table->data.table.slots);
+	table->data.table.old_slots = NULL;
+	table->data.table.count = table->data.table.used = table->data.table.moved = 0;
+	table->data.table.young_keys = 0;
+}
+
+/* for load_image: the keys hashed by address are somewhere else now */
+void table_moved(object *table)
+{
+	table->data.table.young_keys = 1;
+	table->data.table.epoch = gc_statistics()->minor_collections - 1;
+}
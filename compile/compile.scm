@@ -27,21 +27,1533 @@
 	(instr 'goto-if l))
 ;;more later
 
+(define (finish code tail?)
+	(if tail?
+		(combine-instructions code (instr 'return))
+		code))
+
 ;;Hooks
-(define hooks '())
+;Functions registered under the same name are chained, in the order they
+;were registered.
+(define hooks (make-hash-table))
 (define (register-compiler-hook! name fun)
-	(let ((hook (assq name hooks))) 
-		(let ((fun (if (not hook) 
-						fun 
-						(lambda (arg) ((cdr hook) (fun arg))))))
-			(set! hooks (cons (cons name fun) hooks)))))
+	(let ((hook (hash-table-ref hooks name #f))) 
+		(hash-table-set! hooks name
+			(if (not hook) 
+				fun 
+				(lambda (arg) (fun (hook arg)))))))
 (define (call-hook name arg)
-	(let ((hook (assq name hooks)))
+	(let ((hook (hash-table-ref hooks name #f)))
 		(if hook
-			((cdr hook) arg)
+			(hook arg)
 			arg)))
 (define (hook-registered? name)
-	(assq name hooks))
+	(hash-table-contains? hooks name))
 
 ;;Compiler core
-;Not implemented yet
\ No newline at end of file
+;The compile time enviroment is a list of frames, innermost first. Each
+;frame is a list of its variables in slot order. Top level variables
+;aren't in it, the vm keeps them in their symbols. The innermost frame
+;may be a stack frame, (stack var ...), which the vm keeps on its stack
+;instead of the heap; see compile-lambda. The code compiled is in the
+;core language (see expand) with its variables renamed (see rename).
+
+;The address of a variable: (depth . index) in a heap frame, (stack . index)
+;in the stack frame, or #f for a top level variable
+(define (lookup var env)
+	(define (index vars i)
+		(cond
+			((null? vars) #f)
+			((eq? (car vars) var) i)
+			(else (index (cdr vars) (+ i 1)))))
+	(define (iter env depth)
+		(cond
+			((null? env) #f)
+			((stack-frame? (car env))
+				(let ((i (index (cdar env) 0)))
+					(if i
+						(cons 'stack i)
+						(iter (cdr env) depth))))
+			(else
+				(let ((i (index (car env) 0)))
+					(if i
+						(cons depth i)
+						(iter (cdr env) (+ depth 1)))))))
+	(iter env 0))
+
+(define (stack-frame? frame)
+	(and (pair? frame) (eq? (car frame) 'stack)))
+
+;The frames a closure made in env can see
+(define (heap-frames env)
+	(if (and (pair? env) (stack-frame? (car env)))
+		(cdr env)
+		env))
+
+(define (get-local address)
+	(if (eq? (car address) 'stack)
+		(instr 'arg (cdr address))
+		(instr 'local (car address) (cdr address))))
+
+(define (set-local address)
+	(if (eq? (car address) 'stack)
+		(instr 'set-arg (cdr address))
+		(instr 'set-local (car address) (cdr address))))
+
+(define (compile x env tail?)
+	(cond
+		((symbol? x) (finish (compile-ref x env) tail?))
+		((not (pair? x)) (finish (instr 'const x) tail?))
+		(else (compile-form x env tail?))))
+
+(define (compile-form x env tail?)
+	(let ((head (car x)))
+		(cond
+			((eq? head 'quote) (finish (instr 'const (cadr x)) tail?))
+			((eq? head 'define) (finish (compile-define x env) tail?))
+			((eq? head 'set!) (finish (compile-set (cadr x) (caddr x) env) tail?))
+			((eq? head 'if) 
+				(compile-if (cadr x) (caddr x) (if (null? (cdddr x)) #f (cadddr x)) env tail?))
+			((eq? head 'lambda) (finish (compile-lambda (cadr x) (cddr x) env) tail?))
+			((eq? head 'begin) (compile-sequence (cdr x) env tail?))
+			((eq? head 'cond) (compile (cond->if (cdr x)) env tail?))
+			((eq? head 'let) (compile-let (cadr x) (cddr x) env tail?))
+			((eq? head 'and) (compile (and->if (cdr x)) env tail?))
+			((eq? head 'or) (compile-or (cdr x) env tail?))
+			((eq? head 'declare) (finish (instr 'const #f) tail?))
+			((eq? head 'call-direct) (compile-direct-call (cadr x) (cddr x) env tail?))
+			((integrable? head (length (cdr x)) env) 
+				(finish (compile-primitive head (cdr x) env) tail?))
+			(else (compile-call head (cdr x) env tail?)))))
+
+(define (compile-ref var env)
+	(let ((address (lookup var env)))
+		(if address
+			(get-local address)
+			(instr 'global var))))
+
+(define (compile-set var value env)
+	(let ((address (lookup var env)))
+		(combine-instructions
+			(compile value env #f)
+			(if address
+				(set-local address)
+				(instr 'set-global var))
+			(instr 'const 'ok))))
+
+;Internal definitions were given slots in the innermost frame by scan-defines
+(define (compile-define x env)
+	(let ((var (if (pair? (cadr x)) (caadr x) (cadr x)))
+	      (value (cond 
+	                 ((pair? (cadr x)) (cons 'lambda (cons (cdadr x) (cddr x))))
+	                 ((null? (cddr x)) #f)
+	                 (else (caddr x)))))
+		(let ((address (lookup var env)))
+			(combine-instructions
+				(compile value env #f)
+				(cond
+					((null? env) (instr 'define-global var))
+					((and address (memq (car address) '(stack 0))) (set-local address))
+					(else (error 'compile "DEFINE in a bad place:" x)))
+				(instr 'const var)))))
+
+(define (compile-if test then alternative env tail?)
+	(let ((then-label (new-label "then")) (end-label (new-label "endif")))
+		(combine-instructions
+			(compile test env #f)
+			(goto-if then-label)
+			(compile alternative env tail?)
+			(if tail? '() (goto end-label))
+			(label then-label)
+			(compile then env tail?)
+			(if tail? '() (label end-label)))))
+
+(define (flatten-params params)
+	(cond
+		((null? params) '())
+		((symbol? params) (list params))
+		(else (cons (car params) (flatten-params (cdr params))))))
+
+(define (required-count params)
+	(if (pair? params)
+		(+ 1 (required-count (cdr params)))
+		0))
+
+(define (rest-param? params)
+	(if (pair? params)
+		(rest-param? (cdr params))
+		(symbol? params)))
+
+(define (add-var var vars)
+	(if (memq var vars)
+		vars
+		(append vars (list var))))
+
+(define (scan-defines body vars)
+	(cond
+		((null? body) vars)
+		((not (pair? (car body))) (scan-defines (cdr body) vars))
+		((eq? (caar body) 'define)
+			(scan-defines (cdr body)
+				(add-var (if (pair? (cadar body)) (caadar body) (cadar body)) vars)))
+		((eq? (caar body) 'begin)
+			(scan-defines (cdr body) (scan-defines (cdar body) vars)))
+		(else (scan-defines (cdr body) vars))))
+
+(define (add-vars new vars)
+	(if (null? new)
+		vars
+		(add-vars (cdr new) (add-var (car new) vars))))
+
+;The variables in a procedure's frame: its parameters, its internal
+;definitions, and the variables and definitions of the lets in its body
+;that aren't inside another lambda.
+(define (frame-vars body vars)
+	(scan-lets body (scan-defines body vars)))
+
+(define (scan-lets exps vars)
+	(if (pair? exps)
+		(scan-lets (cdr exps) (scan-let (car exps) vars))
+		vars))
+
+(define (scan-let x vars)
+	(cond
+		((not (pair? x)) vars)
+		((memq (car x) '(quote lambda declare)) vars)
+		((eq? (car x) 'let)
+			(scan-lets (cddr x)
+				(scan-defines (cddr x)
+					(add-vars (map car (cadr x)) (scan-lets (map cadr (cadr x)) vars)))))
+		(else (scan-lets x vars))))
+
+;A procedure whose frame no lambda in it refers to is made by stack-closure,
+;and its calls keep their frames on the vm's stack rather than the heap
+(define (compile-lambda params body env)
+	(let ((vars (frame-vars body (flatten-params params)))
+	      (entry (new-label "lambda"))
+	      (after (new-label "after")))
+		(let ((stack? (not (captured? vars body))))
+			(combine-instructions
+				(instr (if stack? 'stack-closure 'closure) 
+					entry (required-count params) (if (rest-param? params) 1 0) (length vars))
+				(goto after)
+				(label entry)
+				(compile-sequence body 
+					(cons (if stack? (cons 'stack vars) vars) (heap-frames env)) 
+					#t)
+				(label after)))))
+
+;Whether a lambda in exps refers to any of vars
+(define (captured? vars exps)
+	(and (pair? exps)
+	     (or (captured-by? vars (car exps)) (captured? vars (cdr exps)))))
+
+(define (captured-by? vars x)
+	(cond
+		((not (pair? x)) #f)
+		((memq (car x) '(quote declare)) #f)
+		((eq? (car x) 'lambda) (mentions-in? vars (cddr x)))
+		(else (captured? vars x))))
+
+(define (mentions? vars x)
+	(cond
+		((symbol? x) (memq x vars))
+		((not (pair? x)) #f)
+		((eq? (car x) 'quote) #f)
+		(else (mentions-in? vars x))))
+
+(define (mentions-in? vars exps)
+	(if (pair? exps)
+		(or (mentions? vars (car exps)) (mentions-in? vars (cdr exps)))
+		(mentions? vars exps)))
+
+
+;A let inside a procedure keeps its variables in the procedure's frame
+;instead of making a closure and calling it. Every variable has a name of
+;its own by now, and without loops a let runs at most once in each call,
+;so no two bindings can share a slot.
+(define (compile-let bindings body env tail?)
+	(if (null? env)
+		(compile (let->application (cons 'let (cons bindings body))) env tail?)
+		(combine-instructions
+			(compile-operands (map cadr bindings) env)
+			(set-locals (reverse (map car bindings)) env)
+			(compile-sequence body env tail?))))
+
+(define (set-locals vars env)
+	(if (null? vars)
+		'()
+		(combine-instructions
+			(set-local (lookup (car vars) env))
+			(set-locals (cdr vars) env))))
+
+(define (compile-sequence exps env tail?)
+	(if (null? (cdr exps))
+		(compile (car exps) env tail?)
+		(combine-instructions
+			(compile (car exps) env #f)
+			(instr 'pop)
+			(compile-sequence (cdr exps) env tail?))))
+
+(define (compile-operands operands env)
+	(if (null? operands)
+		'()
+		(combine-instructions
+			(compile (car operands) env #f)
+			(compile-operands (cdr operands) env))))
+
+(define (compile-call operator operands env tail?)
+	(combine-instructions
+		(compile operator env #f)
+		(compile-operands operands env)
+		(instr (if tail? 'tail-call 'call) (length operands))))
+
+;A call of a procedure lifted out by convert-closures
+(define (compile-direct-call name operands env tail?)
+	(combine-instructions
+		(compile-operands operands env)
+		(instr (if tail? 'tail-call-direct 'call-direct) 
+			name (length operands) (length (cadr (assq name lifted-procedures))))))
+
+(define (compile-lifted procedures)
+	(if (null? procedures)
+		'()
+		(let ((after (new-label "after")))
+			(combine-instructions
+				(goto after)
+				(compile-procedures procedures)
+				(label after)))))
+
+(define (compile-procedures procedures)
+	(if (null? procedures)
+		'()
+		(combine-instructions
+			(label (caar procedures))
+			(compile-sequence (cddar procedures) (list (cons 'stack (cadar procedures))) #t)
+			(compile-procedures (cdr procedures)))))
+
+;Primitives the vm has instructions for, with the number of arguments
+;the instruction takes. They're only used when the name isn't shadowed.
+(define integrable-primitives
+	'((car . 1) (cdr . 1) (cons . 2) (null? . 1) (pair? . 1) (not . 1) (eq? . 2)
+	  (+ . 2) (- . 2) (* . 2) (= . 2) (< . 2) (> . 2)))
+
+(define (integrable? operator count env)
+	(and (symbol? operator)
+	     (not (lookup operator env))
+	     (let ((entry (assq operator integrable-primitives)))
+	     	(and entry (= (cdr entry) count)))))
+
+(define (compile-primitive operator operands env)
+	(combine-instructions
+		(compile-operands operands env)
+		(instr operator)))
+
+(define (compile-or exps env tail?)
+	(cond
+		((null? exps) (finish (instr 'const #f) tail?))
+		((null? (cdr exps)) (compile (car exps) env tail?))
+		(else 
+			(let ((end (new-label "or")))
+				(combine-instructions
+					(compile (car exps) env #f)
+					(instr 'dup)
+					(goto-if end)
+					(instr 'pop)
+					(compile-or (cdr exps) env tail?)
+					(label end)
+					(if tail? (instr 'return) '()))))))
+
+;;Derived forms
+(define (cond->if clauses)
+	(cond
+		((null? clauses) #f)
+		((eq? (caar clauses) 'else) (cons 'begin (cdar clauses)))
+		((null? (cdar clauses)) (list 'or (caar clauses) (cond->if (cdr clauses))))
+		((eq? (cadar clauses) '=>)
+			(let ((temp (gensym)))
+				(list 'let (list (list temp (caar clauses)))
+					(list 'if temp 
+						(list (caddar clauses) temp)
+						(cond->if (cdr clauses))))))
+		(else (list 'if (caar clauses) (cons 'begin (cdar clauses)) (cond->if (cdr clauses))))))
+
+(define (let->application x)
+	(cons (cons 'lambda (cons (map car (cadr x)) (cddr x)))
+	      (map cadr (cadr x))))
+
+(define (and->if exps)
+	(cond
+		((null? exps) #t)
+		((null? (cdr exps)) (car exps))
+		(else (list 'if (car exps) (and->if (cdr exps)) #f))))
+
+;;Core language
+;Derived forms are expanded into the core language: constants, variables,
+;quote, define, set!, if, lambda, begin, let, or, declare and calls.
+;Procedure definitions become definitions of lambdas.
+(define (expand x)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'define)
+			(if (pair? (cadr x))
+				(list 'define (caadr x) (expand (cons 'lambda (cons (cdadr x) (cddr x)))))
+				(cons 'define (cons (cadr x) (expand-all (cddr x))))))
+		((eq? (car x) 'lambda) (cons 'lambda (cons (cadr x) (expand-all (cddr x)))))
+		((eq? (car x) 'let)
+			(cons 'let
+				(cons (map (lambda (binding) (list (car binding) (expand (cadr binding)))) (cadr x))
+					(expand-all (cddr x)))))
+		((eq? (car x) 'cond) (expand (cond->if (cdr x))))
+		((eq? (car x) 'and) (expand (and->if (cdr x))))
+		(else (expand-all x))))
+
+(define (expand-all exps)
+	(map expand exps))
+
+;;Renaming
+;Every variable bound inside a top level form is renamed to a symbol of its
+;own, with lower case letters in it so that it can't clash with a symbol
+;that was read. compile-let relies on this, and so do the passes below,
+;which move code about without worrying about capturing variables.
+;local-vars holds the names made for the form being compiled.
+(define rename-count 0)
+(define local-vars '())
+
+(define (fresh-name var)
+	(set! rename-count (+ rename-count 1))
+	(let ((name (string->symbol 
+					(string-append (symbol->string var) 
+						(string-append ".v" (number->string rename-count))))))
+		(set! local-vars (cons name local-vars))
+		name))
+
+(define (local? var)
+	(memq var local-vars))
+
+;A copy of a temporary is a temporary too, see new-temp
+(define (fresh-names vars)
+	(map (lambda (var) 
+			(let ((name (fresh-name var)))
+				(if (memq var temps) (set! temps (cons name temps)))
+				(cons var name)))
+		vars))
+
+;Renames the variables bound inside x; its free variables are left alone,
+;so this also makes fresh copies of lambdas for inlining.
+(define (rename x env)
+	(cond
+		((symbol? x) 
+			(let ((binding (assq x env)))
+				(if binding (cdr binding) x)))
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda)
+			(let ((params (append (fresh-names (flatten-params (cadr x))) env)))
+				(cons 'lambda 
+					(cons (rename-params (cadr x) params) 
+						(rename-body (cddr x) params)))))
+		((eq? (car x) 'let)
+			(let ((vars (append (fresh-names (map car (cadr x))) env)))
+				(cons 'let
+					(cons (map (lambda (binding) 
+								(list (rename (car binding) vars) (rename (cadr binding) env)))
+							(cadr x))
+						(rename-body (cddr x) vars)))))
+		(else (rename-all x env))))
+
+;An internal definition shadows a parameter of the same name
+(define (rename-body body env)
+	(rename-all body (append (fresh-names (scan-defines body '())) env)))
+
+(define (rename-all exps env)
+	(map (lambda (x) (rename x env)) exps))
+
+(define (rename-params params env)
+	(if (pair? params)
+		(cons (rename (car params) env) (rename-params (cdr params) env))
+		(rename params env)))
+
+;;Utilities for the passes
+(define (keep-if keep? lst)
+	(cond
+		((null? lst) '())
+		((keep? (car lst)) (cons (car lst) (keep-if keep? (cdr lst))))
+		(else (keep-if keep? (cdr lst)))))
+
+(define (remove-vars vars removed)
+	(keep-if (lambda (var) (not (memq var removed))) vars))
+
+(define (shares? a b)
+	(and (pair? a) (or (memq (car a) b) (shares? (cdr a) b))))
+
+(define (trivial? x)
+	(or (symbol? x) (constant? x)))
+
+(define (constant? x)
+	(if (pair? x)
+		(eq? (car x) 'quote)
+		(not (symbol? x))))
+
+(define (constant-value x)
+	(if (pair? x) (cadr x) x))
+
+(define (make-constant value)
+	(if (or (pair? value) (symbol? value) (null? value))
+		(list 'quote value)
+		value))
+
+(define (lambda? x)
+	(and (pair? x) (eq? (car x) 'lambda)))
+
+(define (primitive-call? x)
+	(and (symbol? (car x)) (integrable? (car x) (length (cdr x)) '())))
+
+(define (make-sequence exps)
+	(if (null? (cdr exps))
+		(car exps)
+		(cons 'begin exps)))
+
+(define (make-let bindings body)
+	(if (and (null? bindings) (null? (scan-defines body '())))
+		(make-sequence body)
+		(cons 'let (cons bindings body))))
+
+;The number of times var is used in x
+(define (occurrences var x)
+	(cond
+		((eq? x var) 1)
+		((not (pair? x)) 0)
+		((eq? (car x) 'quote) 0)
+		(else (occurrences-in var x))))
+
+(define (occurrences-in var exps)
+	(if (pair? exps)
+		(+ (occurrences var (car exps)) (occurrences-in var (cdr exps)))
+		(occurrences var exps)))
+
+(define (assigned-vars x vars)
+	(cond
+		((not (pair? x)) vars)
+		((eq? (car x) 'quote) vars)
+		((eq? (car x) 'set!) (assigned-vars (caddr x) (add-var (cadr x) vars)))
+		(else (assigned-vars-in x vars))))
+
+(define (assigned-vars-in exps vars)
+	(if (pair? exps)
+		(assigned-vars-in (cdr exps) (assigned-vars (car exps) vars))
+		vars))
+
+;Replaces the variables in alist with their values
+(define (substitute x alist)
+	(cond
+		((symbol? x)
+			(let ((binding (assq x alist)))
+				(if binding (cdr binding) x)))
+		((not (pair? x)) x)
+		((eq? (car x) 'quote) x)
+		(else (substitute-in x alist))))
+
+(define (substitute-in exps alist)
+	(if (pair? exps)
+		(cons (substitute (car exps) alist) (substitute-in (cdr exps) alist))
+		(substitute exps alist)))
+
+(define (size x)
+	(cond
+		((not (pair? x)) 1)
+		((eq? (car x) 'quote) 1)
+		(else (size-of-all x))))
+
+(define (size-of-all exps)
+	(if (pair? exps)
+		(+ (size (car exps)) (size-of-all (cdr exps)))
+		0))
+
+;;A-normal form
+;Every operand of a call and every test of an if is made trivial, by
+;binding anything else to a temporary first, so the order things happen
+;in is explicit for the passes after. An if, an or or a let can still be
+;the value of a let; the branches of an if and the expressions of an or
+;are normalized on their own.
+(define temps '())
+
+(define (new-temp)
+	(let ((temp (fresh-name 'temp)))
+		(set! temps (cons temp temps))
+		temp))
+
+(define (normalize-term x)
+	(normalize x (lambda (value) value)))
+
+(define (normalize-all exps)
+	(map normalize-term exps))
+
+(define (normalize x k)
+	(cond
+		((trivial? x) (k x))
+		((eq? (car x) 'declare) (k x))
+		((eq? (car x) 'lambda) (k (cons 'lambda (cons (cadr x) (normalize-all (cddr x))))))
+		((eq? (car x) 'let) (normalize-let (cadr x) (cddr x) k))
+		((eq? (car x) 'if)
+			(normalize-name (cadr x)
+				(lambda (test)
+					(k (list 'if test 
+						(normalize-term (caddr x))
+						(if (null? (cdddr x)) #f (normalize-term (cadddr x))))))))
+		((eq? (car x) 'or) (k (cons 'or (normalize-all (cdr x)))))
+		((eq? (car x) 'begin) (normalize-sequence (cdr x) k))
+		((eq? (car x) 'set!) (normalize (caddr x) (lambda (value) (k (list 'set! (cadr x) value)))))
+		((eq? (car x) 'define) 
+			(k (if (null? (cddr x)) x (list 'define (cadr x) (normalize-term (caddr x))))))
+		((primitive-call? x) (normalize-names (cdr x) (lambda (args) (k (cons (car x) args)))))
+		((lambda? (car x)) (normalize-names (cdr x) (lambda (args) (k (cons (normalize-term (car x)) args)))))
+		(else (normalize-names x k))))
+
+;Binds x to a temporary unless it's trivial
+(define (normalize-name x k)
+	(normalize x 
+		(lambda (value)
+			(if (trivial? value)
+				(k value)
+				(let ((temp (new-temp)))
+					(list 'let (list (list temp value)) (k temp)))))))
+
+(define (normalize-names exps k)
+	(if (null? exps)
+		(k '())
+		(normalize-name (car exps) 
+			(lambda (first)
+				(normalize-names (cdr exps) 
+					(lambda (rest) (k (cons first rest))))))))
+
+;Since every variable has its own name, the values of a let can be bound
+;one at a time.
+(define (normalize-let bindings body k)
+	(if (null? bindings)
+		(if (null? (scan-defines body '()))
+			(normalize-sequence body k)
+			(k (cons 'let (cons '() (normalize-all body)))))
+		(normalize (cadar bindings)
+			(lambda (value)
+				(list 'let (list (list (caar bindings) value))
+					(normalize-let (cdr bindings) body k))))))
+
+(define (normalize-sequence exps k)
+	(if (null? (cdr exps))
+		(normalize (car exps) k)
+		(let ((rest (normalize-sequence (cdr exps) k)))
+			(if (and (pair? rest) (eq? (car rest) 'begin))
+				(cons 'begin (cons (normalize-term (car exps)) (cdr rest)))
+				(list 'begin (normalize-term (car exps)) rest)))))
+
+;;Constant folding
+;Calls of primitives on constants are worked out, ifs on constants are
+;decided, and variables bound to constants or to other variables that are
+;never assigned are replaced by what they're bound to.
+(define foldable-primitives
+	(list (cons '+ +) (cons '- -) (cons '* *) (cons '= =) (cons '< <) (cons '> >)
+	      (cons 'car car) (cons 'cdr cdr) (cons 'not not) (cons 'null? null?)
+	      (cons 'pair? pair?) (cons 'eq? eq?)))
+
+(define (foldable? operator values)
+	(cond
+		((not (assq operator foldable-primitives)) #f)
+		((memq operator '(+ - * = < >)) 
+			(and (number? (car values)) (number? (cadr values))))
+		((memq operator '(car cdr)) (pair? (car values)))
+		((eq? operator 'eq?)
+			(and (not (pair? (car values))) (not (string? (car values)))))
+		(else #t)))
+
+(define (fold-constants x)
+	(fold x (assigned-vars x '())))
+
+(define (fold x assigned)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda) (cons 'lambda (cons (cadr x) (fold-all (cddr x) assigned))))
+		((eq? (car x) 'let) (fold-let (cadr x) (cddr x) assigned))
+		((eq? (car x) 'if) 
+			(fold-if (fold (cadr x) assigned)
+				(caddr x) (if (null? (cdddr x)) #f (cadddr x)) assigned))
+		((eq? (car x) 'or) (fold-or (fold-all (cdr x) assigned)))
+		((primitive-call? x) (fold-primitive (car x) (fold-all (cdr x) assigned)))
+		(else (fold-all x assigned))))
+
+(define (fold-all exps assigned)
+	(map (lambda (x) (fold x assigned)) exps))
+
+(define (fold-primitive operator args)
+	(if (all-constant? args)
+		(let ((values (map constant-value args)))
+			(if (foldable? operator values)
+				(make-constant (apply (cdr (assq operator foldable-primitives)) values))
+				(cons operator args)))
+		(cons operator args)))
+
+(define (all-constant? exps)
+	(or (null? exps) 
+		(and (constant? (car exps)) (all-constant? (cdr exps)))))
+
+(define (fold-if test then else assigned)
+	(if (constant? test)
+		(fold (if (constant-value test) then else) assigned)
+		(list 'if test (fold then assigned) (fold else assigned))))
+
+(define (fold-or exps)
+	(cond
+		((null? exps) #f)
+		((null? (cdr exps)) (car exps))
+		((not (constant? (car exps))) (cons 'or exps))
+		((constant-value (car exps)) (car exps))
+		(else (fold-or (cdr exps)))))
+
+(define (propagatable? var value assigned)
+	(and (not (memq var assigned))
+	     (or (constant? value)
+	         (and (symbol? value) (local? value) (not (memq value assigned))))))
+
+(define (fold-let bindings body assigned)
+	(let ((bindings (map (lambda (binding) (list (car binding) (fold (cadr binding) assigned))) 
+						bindings)))
+		(let ((known (propagatable-bindings bindings assigned)))
+			(make-let (remove-bindings bindings known)
+				(fold-all (substitute-in body known) assigned)))))
+
+(define (propagatable-bindings bindings assigned)
+	(cond
+		((null? bindings) '())
+		((propagatable? (caar bindings) (cadar bindings) assigned)
+			(cons (cons (caar bindings) (cadar bindings))
+				(propagatable-bindings (cdr bindings) assigned)))
+		(else (propagatable-bindings (cdr bindings) assigned))))
+
+(define (remove-bindings bindings alist)
+	(cond
+		((null? bindings) '())
+		((assq (caar bindings) alist) (remove-bindings (cdr bindings) alist))
+		(else (cons (car bindings) (remove-bindings (cdr bindings) alist)))))
+
+;;Inlining
+;A call of a known procedure that is small enough is replaced by its body,
+;with its parameters bound to the arguments, and a lambda applied directly
+;becomes a let (beta reduction); constant folding then substitutes the
+;arguments in. Procedures are known if they are bound by a let or an
+;internal definition and never assigned, or if they are defined at the top
+;level of the file being compiled and the file never assigns or redefines
+;them. The latter assumes no other file redefines them either.
+;A local procedure used once is always inlined, as dead code elimination
+;then drops its definition. Any other call is only inlined if the body,
+;once its arguments are substituted in and folded, is no bigger than the
+;call was, so inlining never makes the code bigger; a top level definition
+;stays for other files, so it counts as a use. Only bodies up to
+;inline-budget are tried, as trying costs a copy of the body for each call.
+;Known procedures are kept as (name lambda used-once?).
+(define inline-budget 24)
+(define file-procedures '())
+
+(define (inlinable? name proc uses)
+	(and (lambda? proc)
+	     (proper-params? (cadr proc))
+	     (null? (scan-defines (cddr proc) '()))
+	     (> uses 0)
+	     (or (= uses 1) (not (> (size (cddr proc)) inline-budget)))
+	     (= (occurrences-in name (cddr proc)) 0)))
+
+;The number of times name is used in body, other than by defining it
+(define (uses name body definitions)
+	(- (occurrences-in name body) (count-definitions name definitions)))
+
+(define (proper-params? params)
+	(or (null? params)
+		(and (pair? params) (symbol? (car params)) (proper-params? (cdr params)))))
+
+;The procedures a file defines once at top level and never assigns
+(define (collect-procedures forms)
+	(let ((definitions (toplevel-definitions forms '()))
+	      (assigned (assigned-vars-in forms '()))
+	      (counts (make-hash-table)))
+		(count-occurrences-in forms counts)
+		(known-procedures definitions definitions assigned counts)))
+
+(define (known-procedures definitions all assigned counts)
+	(cond
+		((null? definitions) '())
+		((and (not (memq (caar definitions) assigned))
+		      (= (count-definitions (caar definitions) all) 1)
+		      ;counting the definition as a use, as it stays
+		      (inlinable? (caar definitions) (cdar definitions) (hash-table-ref counts (caar definitions) 0)))
+			(cons (list (caar definitions) (cdar definitions) #f) 
+				(known-procedures (cdr definitions) all assigned counts)))
+		(else (known-procedures (cdr definitions) all assigned counts))))
+
+;Adds up occurrences for every variable in x at once, in the table counts
+(define (count-occurrences x counts)
+	(cond
+		((symbol? x) (hash-table-update! counts x (lambda (n) (+ n 1)) 0))
+		((not (pair? x)) counts)
+		((eq? (car x) 'quote) counts)
+		(else (count-occurrences-in x counts))))
+
+(define (count-occurrences-in exps counts)
+	(if (pair? exps)
+		(begin
+			(count-occurrences (car exps) counts)
+			(count-occurrences-in (cdr exps) counts))
+		(count-occurrences exps counts)))
+
+(define (count-definitions name definitions)
+	(cond
+		((null? definitions) 0)
+		((eq? (caar definitions) name) (+ 1 (count-definitions name (cdr definitions))))
+		(else (count-definitions name (cdr definitions)))))
+
+(define (toplevel-definitions forms definitions)
+	(cond
+		((null? forms) definitions)
+		((not (pair? (car forms))) (toplevel-definitions (cdr forms) definitions))
+		((eq? (caar forms) 'define)
+			(toplevel-definitions (cdr forms) 
+				(cons (cons (cadar forms) (if (null? (cddar forms)) #f (caddar forms))) 
+					definitions)))
+		((eq? (caar forms) 'begin)
+			(toplevel-definitions (cdr forms) (toplevel-definitions (cdar forms) definitions)))
+		(else (toplevel-definitions (cdr forms) definitions))))
+
+(define (inline-procedures x)
+	(inline x file-procedures (assigned-vars x '())))
+
+(define (inline x known assigned)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda) 
+			(cons 'lambda (cons (cadr x) (inline-body (cddr x) known assigned))))
+		((eq? (car x) 'let)
+			(let ((bindings (map (lambda (binding) 
+									(list (car binding) (inline (cadr binding) known assigned)))
+								(cadr x))))
+				(cons 'let 
+					(cons bindings 
+						(inline-body (cddr x) (add-known bindings known assigned (cddr x) '()) assigned)))))
+		((or (memq (car x) '(define set! if or begin)) (primitive-call? x))
+			(inline-all x known assigned))
+		(else (inline-call (inline-all x known assigned) known assigned))))
+
+(define (inline-all exps known assigned)
+	(map (lambda (x) (inline x known assigned)) exps))
+
+;Internal definitions are known throughout the body they're in
+(define (inline-body body known assigned)
+	(let ((definitions (internal-definitions body)))
+		(inline-all body 
+			(add-known (single-definitions definitions definitions) known assigned body definitions) 
+			assigned)))
+
+(define (single-definitions definitions all)
+	(cond
+		((null? definitions) '())
+		((= (count-definitions (caar definitions) all) 1)
+			(cons (car definitions) (single-definitions (cdr definitions) all)))
+		(else (single-definitions (cdr definitions) all))))
+
+(define (internal-definitions body)
+	(cond
+		((null? body) '())
+		((not (pair? (car body))) (internal-definitions (cdr body)))
+		((and (eq? (caar body) 'define) (pair? (cddar body)))
+			(cons (list (cadar body) (caddar body)) (internal-definitions (cdr body))))
+		((eq? (caar body) 'begin)
+			(append (internal-definitions (cdar body)) (internal-definitions (cdr body))))
+		(else (internal-definitions (cdr body)))))
+
+;The bindings of procedures that are inlinable where body is their scope
+(define (add-known bindings known assigned body definitions)
+	(cond
+		((null? bindings) known)
+		((and (not (memq (caar bindings) assigned)) 
+		      (inlinable? (caar bindings) (cadar bindings) (uses (caar bindings) body definitions)))
+			(cons (list (caar bindings) (cadar bindings) (= (uses (caar bindings) body definitions) 1))
+				(add-known (cdr bindings) known assigned body definitions)))
+		(else (add-known (cdr bindings) known assigned body definitions))))
+
+(define (inline-call call known assigned)
+	(let ((binding (if (symbol? (car call)) (assq (car call) known) #f)))
+		(cond
+			(binding
+				(let ((x (beta-reduce (normalize-term (rename (cadr binding) '())) call)))
+					(cond
+						((not x) call)
+						((caddr binding) x)
+						(else
+							(let ((x (fold x assigned)))
+								(if (> (instruction-count x) (instruction-count call)) call x))))))
+			((lambda? (car call)) (or (beta-reduce (car call) call) call))
+			(else call))))
+
+;How many instructions x compiles to, its local variables counting as
+;globals. It's compiled as a tail call, where a call is at its cheapest
+;against anything else, as the call may be one.
+(define (instruction-count x)
+	(count-instructions (compile x '() #t)))
+
+;The body of proc with its parameters bound to the arguments of call, or #f
+(define (beta-reduce proc call)
+	(if (and (proper-params? (cadr proc)) (= (length (cadr proc)) (length (cdr call))))
+		(make-let (map list (cadr proc) (cdr call)) (cddr proc))
+		#f))
+
+;;Dead code elimination
+;Expressions whose values aren't used and that can't have effects are
+;removed, along with the bindings and internal definitions nothing uses.
+(define pure-primitives '(cons not eq? null? pair?))
+
+(define (pure? x)
+	(cond
+		((symbol? x) (local? x))
+		((constant? x) #t)
+		((memq (car x) '(lambda declare)) #t)
+		((and (primitive-call? x) (memq (car x) pure-primitives)) (all-pure? (cdr x)))
+		((eq? (car x) 'if) (all-pure? (cdr x)))
+		(else #f)))
+
+(define (all-pure? exps)
+	(or (null? exps) 
+		(and (pure? (car exps)) (all-pure? (cdr exps)))))
+
+(define (eliminate-dead-code x)
+	(dead-code x))
+
+(define (dead-code x)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda) (cons 'lambda (cons (cadr x) (dead-code-body (cddr x)))))
+		((eq? (car x) 'let)
+			(let ((body (dead-code-body (cddr x))))
+				(make-let (used-bindings (map (lambda (binding) 
+												(list (car binding) (dead-code (cadr binding))))
+											(cadr x))
+							body)
+					body)))
+		((eq? (car x) 'begin) (make-sequence (dead-code-body (cdr x))))
+		(else (map dead-code x))))
+
+(define (used-bindings bindings body)
+	(cond
+		((null? bindings) '())
+		((and (= (occurrences-in (caar bindings) body) 0) (pure? (cadar bindings)))
+			(used-bindings (cdr bindings) body))
+		(else (cons (car bindings) (used-bindings (cdr bindings) body)))))
+
+;Flattens the begins in a body and drops what isn't needed, keeping the last
+;expression, whose value is the body's
+(define (dead-code-body body)
+	(let ((body (map dead-code (flatten-begins body))))
+		(remove-dead body body)))
+
+(define (flatten-begins exps)
+	(cond
+		((null? exps) '())
+		((and (pair? (car exps)) (eq? (caar exps) 'begin))
+			(append (flatten-begins (cdar exps)) (flatten-begins (cdr exps))))
+		(else (cons (car exps) (flatten-begins (cdr exps))))))
+
+(define (remove-dead exps body)
+	(cond
+		((null? (cdr exps)) exps)
+		((pure? (car exps)) (remove-dead (cdr exps) body))
+		((unused-definition? (car exps) body) (remove-dead (cdr exps) body))
+		(else (cons (car exps) (remove-dead (cdr exps) body)))))
+
+(define (unused-definition? x body)
+	(and (pair? x) 
+	     (eq? (car x) 'define)
+	     (local? (cadr x))
+	     (or (null? (cddr x)) (pure? (caddr x)))
+	     (= (occurrences-in (cadr x) body) 1)))
+
+;;Leaving A-normal form
+;On a stack machine a temporary costs a store and a load, so a temporary
+;used once is put back where it's used, as long as nothing but variables,
+;constants and lambdas would then be evaluated before it that weren't
+;before. Those only come from the same call's operands, whose order isn't
+;fixed anyway.
+(define (denormalize x)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda) (cons 'lambda (cons (cadr x) (map denormalize (cddr x)))))
+		((eq? (car x) 'let)
+			(let ((x (cons 'let 
+						(cons (map (lambda (binding) (list (car binding) (denormalize (cadr binding))))
+									(cadr x))
+							(map denormalize (cddr x))))))
+				(if (and (pair? (cadr x))
+						 (null? (cdadr x))
+						 (memq (caaadr x) temps)
+						 (null? (cdddr x))
+						 (= (occurrences (caaadr x) (caddr x)) 1)
+						 (used-first? (caaadr x) (caddr x)))
+					(substitute (caddr x) (list (cons (caaadr x) (cadr (caadr x)))))
+					x)))
+		(else (map denormalize x))))
+
+;Whether the first thing x evaluates that could have an effect is var
+(define (used-first? var x)
+	(cond
+		((eq? x var) #t)
+		((not (pair? x)) #f)
+		((memq (car x) '(quote lambda declare)) #f)
+		((eq? (car x) 'let) (used-first-in? var (append (map cadr (cadr x)) (cddr x))))
+		((memq (car x) '(if or begin)) (used-first? var (cadr x)))
+		((memq (car x) '(set! define)) (and (pair? (cddr x)) (used-first? var (caddr x))))
+		((primitive-call? x) (used-first-in? var (cdr x)))
+		(else (used-first-in? var x))))
+
+(define (used-first-in? var exps)
+	(cond
+		((null? exps) #f)
+		((> (occurrences var (car exps)) 0) (used-first? var (car exps)))
+		((or (trivial? (car exps)) (lambda? (car exps))) (used-first-in? var (cdr exps)))
+		(else #f)))
+
+;;The passes
+;Each pass is a function from a top level form in the core language to an
+;equivalent one. They are chained on the 'optimize hook, so more can be
+;added with define-pass! or register-compiler-hook!; passes also keeps them
+;by name for compile-report.
+(define passes '())
+
+(define (define-pass! name fun)
+	(set! passes (append passes (list (cons name fun))))
+	(register-compiler-hook! 'optimize fun))
+
+(define-pass! 'normalize normalize-term)
+(define-pass! 'fold-constants fold-constants)
+(define-pass! 'inline inline-procedures)
+(define-pass! 'fold-constants fold-constants)
+(define-pass! 'eliminate-dead-code eliminate-dead-code)
+(define-pass! 'denormalize denormalize)
+
+;;Closure conversion
+;A local procedure that is only ever called, with the right number of
+;arguments, and that makes no closures itself, is lifted out of the code
+;it's in: the local variables it uses are passed to it as extra arguments,
+;so it needs no closure, and its calls become call-directs to its label,
+;with its frame on the vm's stack. A variable can only be passed like this
+;if it's never assigned and isn't an internal definition, which might not
+;have been made yet when the call is. The code for the procedures lifted
+;out of a top level form follows the form's code; lifted-procedures holds
+;them as (name frame-vars . body).
+(define lifted-procedures '())
+
+(define (convert-closures x)
+	(let ((lifted (lift-candidates (proper-candidates (local-procedures x '()) x)
+	                               (add-vars (assigned-vars x '()) (defined-vars x '())))))
+		(set! lifted-procedures (map (lambda (procedure) (lift-procedure procedure lifted)) lifted))
+		(convert x lifted)))
+
+;The procedures bound by local definitions and lets in x, as (name . lambda)
+(define (local-procedures x found)
+	(cond
+		((not (pair? x)) found)
+		((memq (car x) '(quote declare)) found)
+		((and (eq? (car x) 'define) (local? (cadr x)) (pair? (cddr x)) (lambda? (caddr x)))
+			(local-procedures (caddr x) (cons (cons (cadr x) (caddr x)) found)))
+		((eq? (car x) 'let)
+			(local-procedures-in x (append (binding-procedures (cadr x)) found)))
+		(else (local-procedures-in x found))))
+
+(define (local-procedures-in exps found)
+	(if (pair? exps)
+		(local-procedures-in (cdr exps) (local-procedures (car exps) found))
+		found))
+
+(define (binding-procedures bindings)
+	(cond
+		((null? bindings) '())
+		((lambda? (cadar bindings)) 
+			(cons (cons (caar bindings) (cadar bindings)) (binding-procedures (cdr bindings))))
+		(else (binding-procedures (cdr bindings)))))
+
+(define (proper-candidates candidates x)
+	(let ((escaped (escaping x candidates '())))
+		(keep-if (lambda (candidate)
+					(and (not (memq (car candidate) escaped))
+					     (= (count-definitions (car candidate) candidates) 1)))
+			candidates)))
+
+;The candidates x uses other than by calling them with the right number
+;of arguments
+(define (escaping x candidates escaped)
+	(cond
+		((symbol? x) (if (assq x candidates) (add-var x escaped) escaped))
+		((not (pair? x)) escaped)
+		((memq (car x) '(quote declare)) escaped)
+		((eq? (car x) 'define) (escaping-in (cddr x) candidates escaped))
+		((eq? (car x) 'lambda) (escaping-in (cddr x) candidates escaped))
+		((and (assq (car x) candidates) (arity-matches? (cadr (cdr (assq (car x) candidates))) (cdr x)))
+			(escaping-in (cdr x) candidates escaped))
+		(else (escaping-in x candidates escaped))))
+
+(define (escaping-in exps candidates escaped)
+	(if (pair? exps)
+		(escaping-in (cdr exps) candidates (escaping (car exps) candidates escaped))
+		escaped))
+
+(define (arity-matches? params args)
+	(and (proper-params? params) (= (length params) (length args))))
+
+(define (defined-vars x vars)
+	(cond
+		((not (pair? x)) vars)
+		((memq (car x) '(quote declare)) vars)
+		((and (eq? (car x) 'define) (local? (cadr x))) (defined-vars-in (cddr x) (add-var (cadr x) vars)))
+		(else (defined-vars-in x vars))))
+
+(define (defined-vars-in exps vars)
+	(if (pair? exps)
+		(defined-vars-in (cdr exps) (defined-vars (car exps) vars))
+		vars))
+
+;Drops the candidates that would need a blocked variable passed, or that
+;make closures, until there are none left to drop. Returns the rest as
+;(name lambda vars-to-pass).
+(define (lift-candidates candidates blocked)
+	(let ((procedures (free-variables candidates)))
+		(let ((kept (keep-if (lambda (procedure)
+								(not (or (shares? (caddr procedure) blocked)
+								         (makes-closures? (cddr (cadr procedure)) candidates))))
+						procedures)))
+			(if (= (length kept) (length procedures))
+				procedures
+				(lift-candidates (map (lambda (procedure) (cons (car procedure) (cadr procedure))) kept)
+					blocked)))))
+
+;The local variables each candidate needs passed: those it refers to but
+;doesn't bind, and those of the candidates it calls
+(define (free-variables candidates)
+	(let ((names (map car candidates)))
+		(define (start candidate)
+			(let ((bound (add-vars names (bound-vars (cdr candidate) '()))))
+				(list (car candidate) (cdr candidate) 
+					(remove-vars (mentioned-locals (cdr candidate) '()) bound)
+					bound)))
+		(map (lambda (procedure) (list (car procedure) (cadr procedure) (caddr procedure)))
+			(add-callee-variables (map start candidates)))))
+
+;procedures are (name lambda vars bound); adds the vars of the procedures
+;each calls to its own until that adds nothing
+(define (add-callee-variables procedures)
+	(define (grow procedure)
+		(let ((callees (keep-if (lambda (callee) (mentions? (list (car callee)) (cadr procedure)))
+							procedures)))
+			(list (car procedure) (cadr procedure)
+				(add-vars (remove-vars (foldr (lambda (vars callee) (add-vars (caddr callee) vars)) '() callees)
+				                       (cadddr procedure))
+					(caddr procedure))
+				(cadddr procedure))))
+	(define (count procedures)
+		(foldr (lambda (n procedure) (+ n (length (caddr procedure)))) 0 procedures))
+	(let ((grown (map grow procedures)))
+		(if (= (count grown) (count procedures))
+			grown
+			(add-callee-variables grown))))
+
+(define (mentioned-locals x vars)
+	(cond
+		((symbol? x) (if (local? x) (add-var x vars) vars))
+		((not (pair? x)) vars)
+		((eq? (car x) 'quote) vars)
+		(else (mentioned-locals-in x vars))))
+
+(define (mentioned-locals-in exps vars)
+	(if (pair? exps)
+		(mentioned-locals-in (cdr exps) (mentioned-locals (car exps) vars))
+		(mentioned-locals exps vars)))
+
+(define (bound-vars x vars)
+	(cond
+		((not (pair? x)) vars)
+		((memq (car x) '(quote declare)) vars)
+		((eq? (car x) 'lambda) (bound-vars-in (cddr x) (add-vars (flatten-params (cadr x)) vars)))
+		((eq? (car x) 'let)
+			(bound-vars-in (cddr x) 
+				(bound-vars-in (map cadr (cadr x)) (add-vars (map car (cadr x)) vars))))
+		((eq? (car x) 'define) (bound-vars-in (cddr x) (add-var (cadr x) vars)))
+		(else (bound-vars-in x vars))))
+
+(define (bound-vars-in exps vars)
+	(if (pair? exps)
+		(bound-vars-in (cdr exps) (bound-vars (car exps) vars))
+		vars))
+
+;Whether exps make closures, other than for the candidates
+(define (makes-closures? exps candidates)
+	(and (pair? exps)
+	     (or (makes-closure? (car exps) candidates) (makes-closures? (cdr exps) candidates))))
+
+(define (makes-closure? x candidates)
+	(cond
+		((not (pair? x)) #f)
+		((memq (car x) '(quote declare)) #f)
+		((eq? (car x) 'lambda) #t)
+		((and (eq? (car x) 'define) (assq (cadr x) candidates)) #f)
+		((eq? (car x) 'let)
+			(or (makes-closures? (map cadr (remove-bindings (cadr x) candidates)) candidates)
+			    (makes-closures? (cddr x) candidates)))
+		(else (makes-closures? x candidates))))
+
+(define (lift-procedure procedure lifted)
+	(let ((params (append (cadr (cadr procedure)) (caddr procedure)))
+	      (body (convert-body (cddr (cadr procedure)) lifted)))
+		(cons (car procedure) (cons (frame-vars body params) body))))
+
+(define (convert x lifted)
+	(cond
+		((not (pair? x)) x)
+		((memq (car x) '(quote declare)) x)
+		((eq? (car x) 'lambda) (cons 'lambda (cons (cadr x) (convert-body (cddr x) lifted))))
+		((eq? (car x) 'let)
+			(cons 'let 
+				(cons (map (lambda (binding) (list (car binding) (convert (cadr binding) lifted)))
+						(remove-bindings (cadr x) lifted))
+					(convert-body (cddr x) lifted))))
+		((lifted-definition? x lifted) (list 'quote (cadr x)))
+		((assq (car x) lifted)
+			(cons 'call-direct 
+				(cons (car x) (append (convert-all (cdr x) lifted) (caddr (assq (car x) lifted))))))
+		(else (convert-all x lifted))))
+
+(define (convert-all exps lifted)
+	(map (lambda (x) (convert x lifted)) exps))
+
+;Lifted definitions are dropped, unless one gives the body its value
+(define (convert-body body lifted)
+	(cond
+		((null? (cdr body)) (list (convert (car body) lifted)))
+		((lifted-definition? (car body) lifted) (convert-body (cdr body) lifted))
+		(else (cons (convert (car body) lifted) (convert-body (cdr body) lifted)))))
+
+(define (lifted-definition? x lifted)
+	(and (pair? x) (eq? (car x) 'define) (assq (cadr x) lifted)))
+
+;;Driver
+;Top level forms are compiled in order, and their values thrown away.
+(define (core-form x)
+	(set! local-vars '())
+	(set! temps '())
+	(set! lifted-procedures '())
+	(rename (expand x) '()))
+
+(define (compile-toplevel x)
+	(let ((x (convert-closures (call-hook 'optimize (core-form x)))))
+		(combine-instructions
+			(compile x '() #f)
+			(instr 'pop)
+			(compile-lifted lifted-procedures))))
+
+(define (read-forms in)
+	(let ((x (read in)))
+		(if (eof-object? x)
+			'()
+			(cons x (read-forms in)))))
+
+(define (read-file name)
+	(let ((in (open-input-file name)))
+		(let ((forms (read-forms in)))
+			(close-input-file in)
+			forms)))
+
+(define (expand-file forms)
+	(set! file-procedures (collect-procedures (expand-all forms)))
+	forms)
+
+(define (compile-file in-name out-name)
+	(let ((forms (expand-file (read-file in-name))) (out (open-output-file out-name)))
+		(define (write-instructions code)
+			(for-each 
+				(lambda (ins) 
+					(write ins out)
+					(write-char #\newline out))
+				code))
+		(for-each (lambda (x) (write-instructions (compile-toplevel x))) forms)
+		(close-output-file out)
+		'done))
+
+;;Reports
+;Prints how many instructions a file compiles to after each pass.
+(define (count-instructions code)
+	(cond
+		((null? code) 0)
+		((eq? (opcode (car code)) 'label) (count-instructions (cdr code)))
+		(else (+ 1 (count-instructions (cdr code))))))
+
+(define (count-form x)
+	(count-instructions (combine-instructions (compile x '() #f) (compile-lifted lifted-procedures))))
+
+;The counts for each stage of x, from the core form on
+(define (count-stages x passes)
+	(if (null? passes)
+		(list (count-form x))
+		(cons (count-form x) (count-stages ((cdar passes) x) (cdr passes)))))
+
+(define (add-counts a b)
+	(if (null? a)
+		'()
+		(cons (+ (car a) (car b)) (add-counts (cdr a) (cdr b)))))
+
+(define (report-stages)
+	(append passes (list (cons 'convert-closures convert-closures))))
+
+;The instructions in-name compiles to at each stage, from the core forms on
+(define (compile-counts in-name)
+	(let ((forms (expand-file (read-file in-name))) (stages (report-stages)))
+		(define (total forms)
+			(if (null? (cdr forms))
+				(count-stages (core-form (car forms)) stages)
+				(add-counts (count-stages (core-form (car forms)) stages) (total (cdr forms)))))
+		(total forms)))
+
+(define (compile-report in-name)
+	(let ((counts (compile-counts in-name)))
+		(define (show names counts)
+			(display (car names))
+			(display ": ")
+			(display (car counts))
+			(write-char #\newline)
+			(if (pair? (cdr counts)) (show (cdr names) (cdr counts))))
+		(show (cons 'core (map car (report-stages))) counts)
+		'done))
+;;C backend
+;compile-program compiles a whole program to C, for the runtime in native/.
+;Each top level form is compiled as for the vm and its instructions are
+;then translated one at a time: the body of each lambda becomes a C
+;function, and so does each lifted procedure, which call-direct then calls
+;directly. native/runtime.h describes the C the instructions become.
+(define c-function-count 0)
+(define c-constants '())            ;the objects in scheme_constants, last first
+(define c-constant-count 0)
+(define c-labels (make-hash-table)) ;the C labels of the function being written
+
+(define (compile-program in-names out-name)
+	(let ((forms (expand-file (read-files in-names))) (out (open-output-file out-name)))
+		(set! c-constants '())
+		(set! c-constant-count 0)
+		(emit out "/* Compiled from")
+		(for-each (lambda (name) (emit out " " name)) in-names)
+		(emit out " by compile.scm */\n\n#include \"runtime.h\"\n\nextern object *scheme_constants[];\n")
+		(let ((forms (map (lambda (x) (write-c-functions (c-functions x) out)) forms)))
+			(emit out "\nobject *scheme_constants[" (+ c-constant-count 1) "];\n\n")
+			(emit out "void scheme_program(void)\n{\n")
+			(emit out "\tscm_protect_constants(scheme_constants, " c-constant-count ");\n")
+			(write-c-constants (reverse c-constants) 0 out)
+			(for-each (lambda (name) (emit out "\t" name "();\n")) forms)
+			(emit out "}\n"))
+		(close-output-file out)
+		'done))
+
+(define (read-files names)
+	(if (null? names)
+		'()
+		(append (read-file (car names)) (read-files (cdr names)))))
+
+(define (emit out . items)
+	(for-each (lambda (item) (display item out)) items))
+
+;The functions for a top level form, as (name kind nreq rest size code), the
+;form's own code first. kind is toplevel, stack or heap for a lambda whose
+;frame is on the stack or the heap, or lifted.
+(define (c-functions x)
+	(let ((x (convert-closures (call-hook 'optimize (core-form x)))))
+		(let ((toplevel (split-code (combine-instructions (compile x '() #f) (instr 'pop))))
+		      (lifted (map (lambda (procedure)
+		                      (cons procedure
+		                            (split-code (compile-sequence (cddr procedure) 
+		                                                          (list (cons 'stack (cadr procedure))) 
+		                                                          #t))))
+		                   lifted-procedures)))
+			(cons (list (new-label "toplevel") 'toplevel 0 0 0 (car toplevel))
+				(append (cdr toplevel)
+					(foldr (lambda (functions procedure)
+							(cons (list (caar procedure) 'lifted 0 0 (length (cadar procedure)) (cadr procedure))
+								(append (cddr procedure) functions)))
+						'()
+						lifted))))))
+
+;Takes the bodies of the lambdas in code out into functions of their own,
+;returning (code . functions). A lambda is compiled as
+;(closure entry ...) (goto after) (label entry) body... (label after).
+(define (split-code code)
+	(cond
+		((null? code) (cons '() '()))
+		((memq (opcode (car code)) '(closure stack-closure))
+			(let ((ins (car code))
+			      (body (take-until (cadr (cadr code)) (cdddr code))))
+				(let ((inner (split-code (car body))) (rest (split-code (cdr body))))
+					(cons (cons ins (car rest))
+						(cons (list (cadr ins) (if (eq? (opcode ins) 'closure) 'heap 'stack)
+								(caddr ins) (cadddr ins) (car (cddddr ins)) (car inner))
+							(append (cdr inner) (cdr rest)))))))
+		(else
+			(let ((rest (split-code (cdr code))))
+				(cons (cons (car code) (car rest)) (cdr rest))))))
+
+;(code before the label . code after it)
+(define (take-until name code)
+	(if (and (eq? (opcode (car code)) 'label) (eq? (cadr (car code)) name))
+		(cons '() (cdr code))
+		(let ((rest (take-until name (cdr code))))
+			(cons (cons (car code) (car rest)) (cdr rest)))))
+
+;Writes the functions and returns the C name of the first
+(define (write-c-functions functions out)
+	(let ((names (map (lambda (function)
+						(set! c-function-count (+ c-function-count 1))
+						(cons (car function) (string-append "f" (number->string c-function-count))))
+					functions)))
+		(emit out "\n")
+		(for-each (lambda (function) (write-c-prototype function names out)) functions)
+		(for-each (lambda (function) (write-c-function function names out)) functions)
+		(cdar names)))
+
+(define (write-c-prototype function names out)
+	(if (eq? (cadr function) 'toplevel)
+		(emit out "static void " (cdr (assq (car function) names)) "(void);\n")
+		(emit out "static object *" (cdr (assq (car function) names)) "(object **base, int n);\n")))
+
+(define (write-c-function function names out)
+	(let ((kind (cadr function)) (name (cdr (assq (car function) names))))
+		(hash-table-clear! c-labels)
+		(if (eq? kind 'toplevel)
+			(emit out "\nstatic void " name "(void)\n{\n\tobject *val, *proc;\n\n")
+			(emit out "\nstatic object *" name "(object **base, int n)\n{\n\tobject *val, *proc;\n\ntop:\n"))
+		(cond
+			((eq? kind 'stack) 
+				(emit out "\tscm_enter_stack(base, n, " (caddr function) ", " (cadddr function) ", " 
+					(car (cddddr function)) ");\n"))
+			((eq? kind 'heap)
+				(emit out "\tscm_enter_heap(base, n, " (caddr function) ", " (cadddr function) ", " 
+					(car (cddddr function)) ");\n"))
+			((eq? kind 'lifted) (emit out "\tscm_enter_lifted(base, n, " (car (cddddr function)) ");\n")))
+		(for-each (lambda (ins) (write-c-instruction ins function names out)) (cadr (cddddr function)))
+		(emit out "}\n")))
+
+;What the instructions call env: see native/runtime.h
+(define (c-env kind)
+	(cond
+		((eq? kind 'stack) "base[-1]->data.closure.env")
+		((eq? kind 'heap) "base[-1]")
+		(else "NULL")))
+
+(define (c-frame kind depth)
+	(if (= depth 0)
+		(c-env kind)
+		(string-append (c-frame kind (- depth 1)) "->data.frame.parent")))
+
+(define (c-label name)
+	(let ((entry (hash-table-ref c-labels name #f)))
+		(if entry
+			entry
+			(let ((label (string-append "L" (number->string (hash-table-count c-labels)))))
+				(hash-table-set! c-labels name label)
+				label))))
+
+(define c-primitives
+	'((car . "CAR") (cdr . "CDR") (cons . "CONS") (null? . "IS_NULL") (pair? . "IS_PAIR") 
+	  (not . "NOT") (eq? . "EQ") (+ . "ADD") (- . "SUB") (* . "MUL") (= . "NUM_EQ") (< . "LT") (> . "GT")))
+
+(define (write-c-instruction ins function names out)
+	(let ((op (opcode ins)) (kind (cadr function)))
+		(cond
+			((eq? op 'const) (emit out "\tPUSH(") (write-c-constant (cadr ins) out) (emit out ");\n"))
+			((eq? op 'local) 
+				(emit out "\tPUSH(CHECK(FRAME_SLOTS(" (c-frame kind (cadr ins)) ")[" (caddr ins) "]));\n"))
+			((eq? op 'set-local) (emit out "\tSET_LOCAL(" (c-frame kind (cadr ins)) ", " (caddr ins) ");\n"))
+			((eq? op 'arg) (emit out "\tPUSH(CHECK(base[" (cadr ins) "]));\n"))
+			((eq? op 'set-arg) (emit out "\tbase[" (cadr ins) "] = POP();\n"))
+			((eq? op 'global) (emit out "\tGLOBAL(" (c-constant (cadr ins)) ");\n"))
+			((eq? op 'set-global) (emit out "\tSET_GLOBAL(" (c-constant (cadr ins)) ");\n"))
+			((eq? op 'define-global) (emit out "\tDEFINE_GLOBAL(" (c-constant (cadr ins)) ");\n"))
+			((eq? op 'pop) (emit out "\tsp--;\n"))
+			((eq? op 'dup) (emit out "\tval = TOP;\n\tPUSH(val);\n"))
+			((eq? op 'label) (emit out (c-label (cadr ins)) ":;\n"))
+			((eq? op 'goto) (emit out "\tgoto " (c-label (cadr ins)) ";\n"))
+			((eq? op 'goto-if) (emit out "\tif (is_true(POP()))\n\t\tgoto " (c-label (cadr ins)) ";\n"))
+			((memq op '(closure stack-closure))
+				(emit out "\tPUSH(scm_make_closure(" (cdr (assq (cadr ins) names)) ", " (c-env kind) ", "
+					(caddr ins) ", " (cadddr ins) ", " (car (cddddr ins)) "));\n"))
+			((eq? op 'call) (emit out "\tval = scm_call(" (cadr ins) ");\n\tPUSH(val);\n"))
+			((eq? op 'tail-call) (emit out "\treturn scm_tail_call(base, " (cadr ins) ");\n"))
+			((eq? op 'return) (emit out "\treturn POP();\n"))
+			((eq? op 'call-direct) 
+				(emit out "\tval = scm_call_direct(" (cdr (assq (cadr ins) names)) ", " (caddr ins) ");\n\tPUSH(val);\n"))
+			((and (eq? op 'tail-call-direct) (eq? (cadr ins) (car function)))
+				(emit out "\tfor (n = 0; n < " (caddr ins) "; n++)\n\t\tbase[n] = sp[n - " (caddr ins) "];\n\tgoto top;\n"))
+			((eq? op 'tail-call-direct)
+				(emit out "\treturn scm_tail_call_direct(base, " (cdr (assq (cadr ins) names)) ", " (caddr ins) ");\n"))
+			((assq op c-primitives) (emit out "\t" (cdr (assq op c-primitives)) "();\n"))
+			(else (error 'compile "No C for instruction" ins)))))
+
+(define (immediate? x)
+	(or (small-integer? x) (char? x) (boolean? x) (null? x)))
+
+;Fixnums on any machine, so the C can say them with make_int
+(define (small-integer? x)
+	(and (number? x) (exact? x) (< x 1073741824) (> x -1073741825)))
+
+;Gives x a slot in scheme_constants, unless it's an immediate, and writes
+;the C for it
+(define (write-c-constant x out)
+	(if (immediate? x)
+		(write-c-value x out)
+		(emit out (c-constant x))))
+
+(define (c-constant x)
+	(set! c-constants (cons x c-constants))
+	(set! c-constant-count (+ c-constant-count 1))
+	(string-append "scheme_constants[" (string-append (number->string (- c-constant-count 1)) "]")))
+
+(define (write-c-constants constants i out)
+	(if (pair? constants)
+		(begin
+			(emit out "\tscheme_constants[" i "] = ")
+			(write-c-value (car constants) out)
+			(emit out ";\n")
+			(write-c-constants (cdr constants) (+ i 1) out))))
+
+;The C for a value, which nothing is collected while making
+(define (write-c-value x out)
+	(cond
+		((small-integer? x) (emit out "make_int(" x ")"))
+		((number? x) (emit out "string_to_number(") (write (number->string x) out) (emit out ", 10)"))
+		((char? x) (emit out "make_char(" (char->integer x) ")"))
+		((eq? x #t) (emit out "true"))
+		((eq? x #f) (emit out "false"))
+		((null? x) (emit out "empty_list"))
+		((symbol? x) (emit out "get_symbol(") (write (symbol->string x) out) (emit out ")"))
+		((string? x) (emit out "make_str(") (write x out) (emit out ")"))
+		((pair? x)
+			(emit out "cons(")
+			(write-c-value (car x) out)
+			(emit out ", ")
+			(write-c-value (cdr x) out)
+			(emit out ")"))
+		((vector? x)
+			(emit out "list_to_vector(")
+			(write-c-value (vector->list x) out)
+			(emit out ")"))
+		((bytevector? x)
+			(emit out "list_to_bytevector(")
+			(write-c-value (bytevector->list x 0) out)
+			(emit out ")"))
+		(else (error 'compile "No C for constant" x))))
+
+(define (bytevector->list x i)
+	(if (= i (bytevector-length x))
+		'()
+		(cons (bytevector-u8-ref x i) (bytevector->list x (+ i 1)))))
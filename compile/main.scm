@@ -0,0 +1,44 @@
+;;;;The command line of the compiler when it's built as a program of its own
+;;;;(make compile/scc):
+;;;;  compile/scc in.scm out.sbc           compiles a file to bytecode for the vm
+;;;;  compile/scc -c out.c in.scm ...      compiles a whole program to C
+;;;;  compile/scc -s in.scm ...            how many instructions each file
+;;;;                                       compiles to without the passes
+;;;;                                       and with them, failing if they
+;;;;                                       made any file bigger
+
+(define (usage)
+	(display "Usage: scc in.scm out.sbc, scc -c out.c in.scm ..., or scc -s in.scm ...")
+	(write-char #\newline)
+	(exit))
+
+(define (command-line args)
+	(cond
+		((null? args) (usage))
+		((eq? (string->symbol (car args)) (string->symbol "-c"))
+			(if (or (null? (cdr args)) (null? (cddr args)))
+				(usage)
+				(compile-program (cddr args) (cadr args))))
+		((eq? (string->symbol (car args)) (string->symbol "-s"))
+			(if (null? (cdr args))
+				(usage)
+				(if (sizes-grew? (cdr args)) (exit 1))))
+		((= (length args) 2) (compile-file (car args) (cadr args)))
+		(else (usage))))
+
+(define (sizes-grew? files)
+	(if (null? files)
+		#f
+		(let ((counts (compile-counts (car files))))
+			(let ((core (car counts)) (final (car (reverse counts))))
+				(display (car files))
+				(display ": ")
+				(display core)
+				(display " -> ")
+				(display final)
+				(if (> final core) (display " bigger"))
+				(write-char #\newline)
+				(or (sizes-grew? (cdr files)) (> final core))))))
+
+(command-line (cdr args))
+(exit)
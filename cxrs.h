@@ -30,4 +30,35 @@
 #define cdaddr(x) cdr(car(cdr(cdr(x))))
 #define cadddr(x) car(cdr(cdr(cdr(x))))
 #define cddddr(x) cdr(cdr(cdr(cdr(x))))
+
+#define CXRS(X) \
+	X(caar) \
+	X(cdar) \
+	X(cadr) \
+	X(cddr) \
+	X(caaar) \
+	X(cdaar) \
+	X(cadar) \
+	X(cddar) \
+	X(caadr) \
+	X(cdadr) \
+	X(caddr) \
+	X(cdddr) \
+	X(caaaar) \
+	X(cdaaar) \
+	X(cadaar) \
+	X(cddaar) \
+	X(caadar) \
+	X(cdadar) \
+	X(caddar) \
+	X(cdddar) \
+	X(caaadr) \
+	X(cdaadr) \
+	X(cadadr) \
+	X(cddadr) \
+	X(caaddr) \
+	X(cdaddr) \
+	X(cadddr) \
+	X(cddddr)
+
 #endif /* inclusion guard */
@@ -5,7 +5,11 @@
   #define caar(x) car(car(x))
   #define cadr(x) car(cdr(x))
 # ...
-# up to $1 levels deep
+# up to $1 levels deep, and then
+#
+#  #define CXRS(X) X(caar) X(cadr) ...
+#
+# listing all of their names, so that prims.c can make a primitive of each
 
 
 cat <<INCLUDEGUARD
@@ -27,6 +31,7 @@ outputone(){
 		paren=")$paren"
 	done
 	echo "#define ${macro}r(x) ${definition}x$paren"
+	names="$names ${macro}r"
 }
 
 #Outputs several definitions given strings of as and ds as inputs
@@ -36,6 +41,7 @@ output(){
 	done
 }
 
+names=
 current="a d"
 for i in $(seq 2 $1); do
 	next=
@@ -46,4 +52,11 @@ for i in $(seq 2 $1); do
 	current=$next
 done
 
+echo
+printf '#define CXRS(X)'
+for name in $names; do
+	printf ' \\\n\tX(%s)' $name
+done
+echo
+echo
 echo "#endif /* inclusion guard */"
\ No newline at end of file
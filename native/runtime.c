@@ -0,0 +1,264 @@
+/*
+ * The runtime for programs compiled to C, see runtime.h.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "runtime.h"
+
+#define STACK_SIZE (1 << 20)        /* in objects */
+#define STACK_MARGIN 4096           /* room kept for pushes between calls */
+#define C_STACK_SIZE ((size_t) 1 << 30) /* non-tail calls nest on it, reserved lazily */
+
+object **scm_sp, **scm_stack_end;
+static object **stack;
+
+static object **constants_end;
+
+/* the count and function of a pending tail call, NULL for a closure */
+static int tail_n;
+static native_fn tail_fn;
+
+object *scm_unassigned(void)
+{
+	eval_err("unassigned variable", empty_list);
+}
+
+static void check_stack(object **top, object *proc)
+{
+	if (top >= scm_stack_end - STACK_MARGIN)
+		eval_err("stack overflow in", proc);
+}
+
+/*
+ * Replaces any arguments beyond the required ones with a list of them,
+ * and returns how many there are then.
+ */
+static int rest_argument(object *proc, object **args, int n, int nreq, int rest)
+{
+	object *list = empty_list;
+	int i;
+
+	if (n < nreq)
+		eval_err("Not enough arguments to a function:", proc);
+	for (i = n; i > nreq; i--)
+		list = cons(args[i - 1], list);
+	if (!rest){
+		if (n > nreq)
+			eval_err("Too many arguments to a function, excessive arguments are:", list);
+		return n;
+	}
+	args[nreq] = list;
+	return nreq + 1;
+}
+
+void scm_enter_stack(object **base, int n, int nreq, int rest, int size)
+{
+	if (n != nreq || rest)
+		n = rest_argument(base[-1], base, n, nreq, rest);
+	check_stack(base + size, base[-1]);
+	for (; n < size; n++)
+		base[n] = NULL;     /* unassigned internal definitions */
+	sp = base + size;
+	gc_safe_point();
+}
+
+void scm_enter_heap(object **base, int n, int nreq, int rest, int size)
+{
+	object *proc = base[-1], *frame;
+	int i;
+
+	if (n != nreq || rest)
+		n = rest_argument(proc, base, n, nreq, rest);
+	/* nothing is collected before the frame is filled in */
+	frame = alloc_frame(size);
+	frame->data.frame.parent = proc->data.closure.env;
+	for (i = 0; i < n; i++)
+		FRAME_SLOTS(frame)[i] = base[i];
+	for (; i < size; i++)
+		FRAME_SLOTS(frame)[i] = NULL;
+	base[-1] = frame;
+	sp = base;
+	gc_safe_point();
+}
+
+void scm_enter_lifted(object **base, int n, int size)
+{
+	check_stack(base + size, empty_list);
+	for (; n < size; n++)
+		base[n] = NULL;
+	sp = base + size;
+	gc_safe_point();
+}
+
+/*
+ * Calls the procedure at frame with the n arguments after it, or fn if
+ * it isn't NULL, and then any tail calls that makes, until one returns a
+ * value.
+ */
+static object *run(object **frame, int n, native_fn fn)
+{
+	object *proc, *args, *val;
+
+	for (;;){
+		if (fn == NULL){
+			proc = frame[0];
+			if (is_heap_type(proc, scm_closure) && proc->data.closure.native != NULL)
+				fn = proc->data.closure.native;
+			else if (!is_heap_type(proc, scm_prim_fun) && !is_heap_type(proc, scm_lambda))
+				eval_err("not a function:", proc);
+			else if (is_heap_type(proc, scm_prim_fun) && obj2prim_proc(proc) == apply_proc){
+				if (n != 2)
+					eval_err("APPLY takes a function and a list of arguments, not",
+						cons(frame[1], cons(frame[2], empty_list)));
+				frame[0] = frame[1];
+				args = frame[2];
+				for (n = 0; args != empty_list; args = cdr(args), n++){
+					check_stack(frame + n + 1, frame[0]);
+					frame[n + 1] = car(args);
+				}
+				continue;
+			} else {
+				args = empty_list;
+				while (n > 0)
+					args = cons(frame[n--], args);
+				sp = frame;
+				if (is_heap_type(proc, scm_lambda))
+					return apply(proc, args); /* made by load or eval */
+				if (obj2prim_proc(proc) == eval_proc)
+					return eval(car(args), cadr(args));
+				return obj2prim_proc(proc)(args);
+			}
+		}
+		sp = frame + 1 + n;
+		if ((val = fn(frame + 1, n)) != NULL)
+			return val;
+		n = tail_n;
+		fn = tail_fn;
+	}
+}
+
+object *scm_call(int n)
+{
+	object **frame = sp - n - 1, *val;
+
+	val = run(frame, n, NULL);
+	sp = frame;
+	return val;
+}
+
+object *scm_tail_call(object **base, int n)
+{
+	object **args = sp - n - 1;
+	int i;
+
+	for (i = 0; i <= n; i++)
+		base[i - 1] = args[i];
+	sp = base + n;
+	tail_n = n;
+	tail_fn = NULL;
+	return NULL;
+}
+
+object *scm_call_direct(native_fn fn, int n)
+{
+	object **frame = sp - n, *val;
+	int i;
+
+	/* the arguments move up a slot, which the callee owns */
+	for (i = n; i > 0; i--)
+		frame[i] = frame[i - 1];
+	frame[0] = false;
+	val = run(frame, n, fn);
+	sp = frame;
+	return val;
+}
+
+object *scm_tail_call_direct(object **base, native_fn fn, int n)
+{
+	object **args = sp - n;
+	int i;
+
+	for (i = 0; i < n; i++)
+		base[i] = args[i];
+	sp = base + n;
+	tail_n = n;
+	tail_fn = fn;
+	return NULL;
+}
+
+/* calls proc with the list args, for the interpreter's apply_closure */
+static object *apply_native_closure(object *proc, object *args)
+{
+	object **frame = sp, *val;
+	int n;
+
+	check_stack(frame, proc);
+	frame[0] = proc;
+	for (n = 0; args != empty_list; args = cdr(args), n++){
+		check_stack(frame + n + 1, proc);
+		frame[n + 1] = car(args);
+	}
+	sp = frame + n + 1;
+	val = run(frame, n, NULL);
+	sp = frame;
+	return val;
+}
+
+object *scm_make_closure(native_fn fn, object *env, int nreq, int rest, int size)
+{
+	object *closure = alloc_obj(scm_closure);
+
+	closure->data.closure.native = fn;
+	closure->data.closure.env = env;
+	closure->data.closure.code = NULL;
+	closure->data.closure.entry = NULL;
+	closure->data.closure.nreq = nreq;
+	closure->data.closure.rest = rest;
+	closure->data.closure.frame_size = size;
+	closure->data.closure.stack_frame = 0;
+	return closure;
+}
+
+void scm_protect_constants(object **constants, int n)
+{
+	constants_end = constants + n;
+	gc_protect_stack(constants, &constants_end);
+}
+
+static void *run_program(void *unused)
+{
+	scheme_program();
+	return NULL;
+}
+
+int main(int argc, const char **argv)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	init_constants();
+	init_enviroment(global_enviroment);
+	set_arg_var(argc, argv);
+
+	stack = malloc(STACK_SIZE * sizeof(object *));
+	if (stack == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	scm_stack_end = stack + STACK_SIZE;
+	sp = stack;
+	gc_protect_stack(stack, &scm_sp);
+	apply_closure = apply_native_closure;
+
+	/* the main thread's stack is too small for deep recursion */
+	pthread_attr_init(&attr);
+	if (pthread_attr_setstacksize(&attr, C_STACK_SIZE) != 0
+			|| pthread_create(&thread, &attr, run_program, NULL) != 0){
+		fprintf(stderr, "Can't start the program.\n");
+		exit(1);
+	}
+	pthread_join(thread, NULL);
+	return 0;
+}
@@ -0,0 +1,111 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+/*
+ * The runtime for programs compiled to C by compile.scm (see the C
+ * backend there). Generated code includes this and is linked with
+ * runtime.o and bootstrap/libscheme.a, which provides the object layer:
+ * the allocator, collector, reader, printer and primitive procedures.
+ *
+ * Compiled code works the way the vm does, with C in place of threaded
+ * code. Every value lives on a value stack that the collector scans, so
+ * that nothing needs protecting when it moves objects; C variables only
+ * hold values between calls. Each lambda becomes a C function
+ *
+ *   object *fn(object **base, int n)
+ *
+ * called with its n arguments at base and the slot below them its own:
+ * a closure is called with itself there, and a procedure whose frame is
+ * on the heap keeps the frame there once it has made it. A function
+ * returns its value, or NULL after setting up a tail call, which the
+ * caller's trampoline (scm_run) then makes. So tail calls don't grow the
+ * C stack, but other calls do.
+ */
+
+#include "../bootstrap/bootstrap.h"
+#include "../bootstrap/object.h"
+
+typedef object *(*native_fn)(object **base, int n);
+
+extern object **scm_sp, **scm_stack_end;
+#define sp scm_sp
+
+#define PUSH(x) (*sp++ = (x))
+#define POP() (*--sp)
+#define TOP (sp[-1])
+
+/* frame entry: check and place the arguments, then a safe point */
+void scm_enter_stack(object **base, int n, int nreq, int rest, int size);
+void scm_enter_heap(object **base, int n, int nreq, int rest, int size);
+void scm_enter_lifted(object **base, int n, int size);
+
+/* calls; the procedure and its arguments are on the stack */
+object *scm_call(int n);
+object *scm_tail_call(object **base, int n);
+object *scm_call_direct(native_fn fn, int n);
+object *scm_tail_call_direct(object **base, native_fn fn, int n);
+
+object *scm_make_closure(native_fn fn, object *env, int nreq, int rest, int size);
+object *scm_unassigned(void) __attribute__((noreturn));
+
+/* the constants of a program, set up before it runs */
+void scm_protect_constants(object **constants, int n);
+
+/* the generated code's entry point */
+void scheme_program(void);
+
+#define CHECK(x) ((val = (x)) == NULL ? scm_unassigned() : val)
+
+#define GLOBAL(symbol) \
+	do { \
+		if ((symbol)->data.sym.value == NULL) \
+			eval_err("unbound variable", (symbol)); \
+		PUSH((symbol)->data.sym.value); \
+	} while (0)
+#define SET_GLOBAL(symbol) \
+	do { \
+		if ((symbol)->data.sym.value == NULL) \
+			eval_err("unbound variable", (symbol)); \
+		write_barrier((symbol), TOP); \
+		(symbol)->data.sym.value = POP(); \
+	} while (0)
+#define DEFINE_GLOBAL(symbol) \
+	do { \
+		write_barrier((symbol), TOP); \
+		(symbol)->data.sym.value = POP(); \
+	} while (0)
+#define SET_LOCAL(frame, i) \
+	do { \
+		proc = (frame); \
+		val = POP(); \
+		write_barrier(proc, val); \
+		FRAME_SLOTS(proc)[i] = val; \
+	} while (0)
+
+/* the vm's inline primitives */
+#define ARITH(fn) \
+	do { \
+		val = POP(); \
+		TOP = fn(TOP, val); \
+	} while (0)
+#define COMPARE(result) \
+	do { \
+		val = POP(); \
+		TOP = make_bool(num_compare(TOP, val) == (result)); \
+	} while (0)
+
+#define CAR() (TOP = is_heap_type(TOP, scm_pair) ? TOP->data.pair.car : car(TOP))
+#define CDR() (TOP = is_heap_type(TOP, scm_pair) ? TOP->data.pair.cdr : cdr(TOP))
+#define CONS() (val = POP(), TOP = cons(TOP, val))
+#define IS_NULL() (TOP = make_bool(TOP == empty_list))
+#define IS_PAIR() (TOP = make_bool(is_heap_type(TOP, scm_pair)))
+#define NOT() (TOP = make_bool(TOP == false))
+#define EQ() (val = POP(), TOP = make_bool(TOP == val))
+#define ADD() ARITH(num_add)
+#define SUB() ARITH(num_sub)
+#define MUL() ARITH(num_mul)
+#define NUM_EQ() COMPARE(0)
+#define LT() COMPARE(-1)
+#define GT() COMPARE(1)
+
+#endif /*include guard*/
@@ -1,39 +1,113 @@
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
-char peek(FILE *in){
-	char c = getc(in);
-	ungetc(c, in);
-	return c;
+#define SOURCE_BLOCK (64 * 1024)
+
+source *open_source(FILE *file)
+{
+	source *in = malloc(sizeof(source));
+
+	if (in == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	in->file = file;
+	in->buf = NULL;     /* until something is read */
+	in->pos = in->end = in->size = 0;
+	in->at_eof = 0;
+	in->line = in->column = 0;
+	return in;
 }
 
+void close_source(source *in)
+{
+	fclose(in->file);
+	free(in->buf);
+	free(in);
+}
 
-void eat_ws(FILE *in)
+/* moves the start of buf on to buf[end] */
+static void count_lines(source *in, size_t end)
 {
-	int c;
-	while((c = getc(in)) != EOF){
-		if (isspace(c)) continue;
-		else if (c == ';'){  /* comment - ignore */
-			while((c = getc(in)) != '\n' && c != EOF);
-			continue;
-		}
-		ungetc(c, in);
-		break;
+	unsigned char *p = in->buf, *nl;
+
+	while ((nl = memchr(p, '\n', in->buf + end - p)) != NULL){
+		in->line++;
+		in->column = 0;
+		p = nl + 1;
 	}
+	in->column += in->buf + end - p;
 }
 
-void eat_expected_str(FILE *in, char *str)
+/* 
+ * Throws away the block read, and reads the next. This returns what's
+ * there, without waiting for a whole block, so a terminal gives a line at
+ * a time.
+ */
+int refill_source(source *in)
 {
-	char c;
+	ssize_t n;
+
+	count_lines(in, in->end);
+	in->pos = in->end = 0;
+	if (in->at_eof)
+		return 0;
+	if (in->buf == NULL){
+		if ((in->buf = malloc(SOURCE_BLOCK)) == NULL){
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		in->size = SOURCE_BLOCK;
+	}
+	while ((n = read(fileno(in->file), in->buf, in->size)) < 0 && errno == EINTR)
+		;
+	if (n <= 0){
+		in->at_eof = 1;
+		return 0;
+	}
+	in->end = n;
+	return 1;
+}
 
-	while(*str != '\0'){
-		c = getc(in);
-		if(c != *str++){
-			fprintf(stderr, "Unexpected character: expecting %s, got %c\n", str, c);
+void unget_source(source *in, int c)
+{
+	if (c == EOF)
+		return;
+	if (in->pos > 0){
+		in->buf[--in->pos] = c;
+		return;
+	}
+	/* at the start of the block, so make room before it */
+	if (in->end == in->size){
+		in->size = in->size ? in->size * 2 : SOURCE_BLOCK;
+		if ((in->buf = realloc(in->buf, in->size)) == NULL){
+			fprintf(stderr, "Out of memory.\n");
 			exit(1);
 		}
 	}
+	memmove(in->buf + 1, in->buf, in->end);
+	in->buf[0] = c;
+	in->end++;
+	if (in->column > 0)
+		in->column--;
+}
+
+void source_position(source *in, long *line, long *column)
+{
+	long l = in->line, c = in->column;
+	size_t i;
+
+	for (i = 0; i < in->pos; i++){
+		if (in->buf[i] == '\n'){
+			l++;
+			c = 0;
+		} else c++;
+	}
+	*line = l + 1;
+	*column = c + 1;
 }
 
 #define INT2STR_BUFLEN 12 /* a 32 bit integer is never longer than 12 digits in decimal */
@@ -45,15 +119,12 @@ char *int_to_string(int num)
 }
 
 char *str_append(char* first, char *second){
-	char *buf = malloc(strlen(first) + strlen(second) + 1); /* +1 for null character */
-	char *ret;
+	size_t len1 = strlen(first), len2 = strlen(second);
+	char *buf = malloc(len1 + len2 + 1); /* +1 for null character */
 	if(buf == NULL)
 		return NULL;
 
-	strcpy(buf, first);
-	strcat(buf, second);
-
-	ret = strdup(buf);
-	free(buf);
-	return ret;
+	memcpy(buf, first, len1);
+	memcpy(buf + len1, second, len2 + 1);
+	return buf;
 }
\ No newline at end of file
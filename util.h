@@ -2,11 +2,40 @@
 #define UTIL_H
 #include <stdio.h>
 
+/*
+ * A source is an input file read a block at a time with read(2), so that
+ * the reader can scan its buffer directly instead of calling getc for
+ * every character. It takes the file over: nothing else should read it
+ * through stdio once it's been made. It doesn't count lines as they go
+ * past; source_position works them out when they're wanted.
+ */
+typedef struct source {
+	FILE *file;
+	unsigned char *buf;
+	size_t pos;         /* the next character is buf[pos] */
+	size_t end;         /* and the block read ends at buf[end] */
+	size_t size;
+	int at_eof;
+	long line, column;  /* where buf starts, from 0 */
+} source;
+
+source *open_source(FILE *file);
+void close_source(source *in); /* closes the file as well */
+int refill_source(source *in); /* 0 at the end of the file */
+void unget_source(source *in, int c);
+void source_position(source *in, long *line, long *column); /* of buf[pos], from 1 */
+
+static inline int source_peek(source *in)
+{
+	return in->pos < in->end || refill_source(in) ? in->buf[in->pos] : EOF;
+}
+
+static inline int source_getc(source *in)
+{
+	return in->pos < in->end || refill_source(in) ? in->buf[in->pos++] : EOF;
+}
 
-void eat_ws(FILE *in);
-char peek(FILE *in);
-void eat_expected_str(FILE *in, char *str);
 char *int_to_string(int num);
 char *str_append(char* first, char *second);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,1198 @@
+/*
+ * A virtual machine for the bytecode that compile/compile.scm produces.
+ * It runs on the object layer of the bootstrap interpreter: the reader,
+ * printer, collector and primitive procedures are all shared with it.
+ *
+ * A bytecode file is a sequence of instructions, each a list of an
+ * opcode and its operands, as written by compile-file. A file is
+ * assembled into threaded code: an array of words in which each
+ * instruction is the address of the code that runs it, followed by its
+ * operands. Dispatch is then a single indirect jump (GNU C's computed
+ * goto), with no decoding and no switch. The assembled code is cached
+ * in an object file, see below.
+ *
+ * The machine's registers are pc, the next word of threaded code; env,
+ * the current frame (NULL at top level); code, the code object pc is
+ * in; sp, the top of the value stack; and base, where the current
+ * procedure's part of the value stack starts. Arguments are pushed on
+ * the value stack. A procedure made by closure copies them into a heap
+ * frame on entry, since a closure it makes may capture the frame; one
+ * made by stack-closure, which the compiler knows makes no such
+ * closure, leaves them where they are and keeps its whole frame in the
+ * stack slots from base up, leaving env as the frame it was made in.
+ * call-direct calls a procedure the compiler lifted out to its label,
+ * with no closure at all. A call that isn't a tail call first pushes a
+ * continuation of four words under the arguments: the return address
+ * and the caller's base (both tagged as fixnums so the collector leaves
+ * them alone), env and code.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../bootstrap/bootstrap.h"
+#include "../bootstrap/object.h"
+
+#ifndef __GNUC__
+#  error "the vm needs GNU C's labels as values"
+#endif
+
+#define STACK_SIZE (1 << 20)        /* in objects */
+#define STACK_MARGIN 4096           /* room kept for pushes between calls */
+
+/*
+ * The instructions. Each operand is one word: o is an object, i an
+ * integer and l the name of a label, which is assembled into the address
+ * it labels. Opcodes with no name are only produced by the assembler.
+ */
+#define INSTRUCTIONS \
+	X(op_halt, NULL, "") \
+	X(op_const, "CONST", "o") \
+	X(op_local0, NULL, "i") \
+	X(op_local, "LOCAL", "ii") \
+	X(op_set_local, "SET-LOCAL", "ii") \
+	X(op_arg, "ARG", "i") \
+	X(op_set_arg, "SET-ARG", "i") \
+	X(op_global, "GLOBAL", "o") \
+	X(op_set_global, "SET-GLOBAL", "o") \
+	X(op_define_global, "DEFINE-GLOBAL", "o") \
+	X(op_pop, "POP", "") \
+	X(op_dup, "DUP", "") \
+	X(op_goto, "GOTO", "l") \
+	X(op_goto_if, "GOTO-IF", "l") \
+	X(op_closure, "CLOSURE", "liii") \
+	X(op_stack_closure, "STACK-CLOSURE", "liii") \
+	X(op_call, "CALL", "i") \
+	X(op_tail_call, "TAIL-CALL", "i") \
+	X(op_call_direct, "CALL-DIRECT", "lii") \
+	X(op_tail_call_direct, "TAIL-CALL-DIRECT", "lii") \
+	X(op_return, "RETURN", "") \
+	X(op_car, "CAR", "") \
+	X(op_cdr, "CDR", "") \
+	X(op_cons, "CONS", "") \
+	X(op_is_null, "NULL?", "") \
+	X(op_is_pair, "PAIR?", "") \
+	X(op_not, "NOT", "") \
+	X(op_eq, "EQ?", "") \
+	X(op_add, "+", "") \
+	X(op_sub, "-", "") \
+	X(op_mul, "*", "") \
+	X(op_num_eq, "=", "") \
+	X(op_lt, "<", "") \
+	X(op_gt, ">", "")
+
+#define X(op, name, operands) op,
+enum opcode {INSTRUCTIONS num_opcodes};
+#undef X
+
+static struct {
+	char *name;
+	char *operands;
+	object *sym;
+} instructions[] = {
+#define X(op, name, operands) {name, operands, NULL},
+	INSTRUCTIONS
+#undef X
+};
+
+static void **op_addresses;         /* set by run(NULL) */
+
+static object **stack, **stack_end;
+static object **vm_sp;              /* sp, whenever the collector might run */
+
+static object *label_symbol;
+static object *apply_prim, *apply_code; /* call 2 then halt, see apply_vm_closure */
+
+/*
+ * Assembler
+ */
+
+struct assembly {
+	void **insns;
+	int length, size;
+	int *relocs;
+	int nrelocs, relocs_size;
+	struct {object *name; int pos;} *labels, *fixups;
+	int nlabels, labels_size, nfixups, fixups_size;
+};
+
+static void *grow_array(void *array, int *size, int elem_size)
+{
+	*size = *size ? *size * 2 : 64;
+	array = realloc(array, *size * elem_size);
+	if (array == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return array;
+}
+
+static void emit(struct assembly *a, void *word)
+{
+	if (a->length == a->size)
+		a->insns = grow_array(a->insns, &a->size, sizeof(void *));
+	a->insns[a->length++] = word;
+}
+
+static void emit_object(struct assembly *a, object *obj)
+{
+	if (!is_immediate(obj)){
+		if (a->nrelocs == a->relocs_size)
+			a->relocs = grow_array(a->relocs, &a->relocs_size, sizeof(int));
+		a->relocs[a->nrelocs++] = a->length;
+	}
+	emit(a, obj);
+}
+
+static void emit_label_ref(struct assembly *a, object *name)
+{
+	if (a->nfixups == a->fixups_size)
+		a->fixups = grow_array(a->fixups, &a->fixups_size, sizeof(*a->fixups));
+	a->fixups[a->nfixups].name = name;
+	a->fixups[a->nfixups++].pos = a->length;
+	emit(a, NULL);
+}
+
+static void add_label(struct assembly *a, object *name)
+{
+	if (a->nlabels == a->labels_size)
+		a->labels = grow_array(a->labels, &a->labels_size, sizeof(*a->labels));
+	a->labels[a->nlabels].name = name;
+	a->labels[a->nlabels++].pos = a->length;
+}
+
+static enum opcode find_opcode(object *name)
+{
+	int i;
+	for (i = 0; i < num_opcodes; i++)
+		if (instructions[i].sym == name)
+			return i;
+	eval_err("unknown instruction", name);
+}
+
+static void assemble_instruction(struct assembly *a, object *ins)
+{
+	enum opcode op;
+	object *operands;
+	char *kind;
+
+	if (!check_type(scm_pair, ins, 0))
+		eval_err("bad instruction", ins);
+	if (car(ins) == label_symbol){
+		if (!check_type(scm_pair, cdr(ins), 0))
+			eval_err("bad instruction", ins);
+		add_label(a, cadr(ins));
+		return;
+	}
+
+	op = find_opcode(car(ins));
+	operands = cdr(ins);
+	if (op == op_local && check_type(scm_pair, operands, 0) && car(operands) == make_int(0)){
+		op = op_local0;
+		operands = cdr(operands);
+	}
+
+	emit(a, op_addresses[op]);
+	for (kind = instructions[op].operands; *kind; kind++, operands = cdr(operands)){
+		if (!check_type(scm_pair, operands, 0))
+			eval_err("too few operands in", ins);
+		switch (*kind){
+		case 'o':
+			emit_object(a, car(operands));
+			break;
+		case 'i':
+			emit(a, (void *) (intptr_t) obj2int(car(operands)));
+			break;
+		case 'l':
+			emit_label_ref(a, car(operands));
+			break;
+		}
+	}
+	if (operands != empty_list)
+		eval_err("too many operands in", ins);
+}
+
+/* reads the instructions in a file and returns the code object for them */
+static object *assemble(source *in)
+{
+	struct assembly a = {0};
+	object *ins, *code;
+	int i, j;
+
+	while ((ins = read_datum(in)) != eof)
+		assemble_instruction(&a, ins);
+	emit(&a, op_addresses[op_halt]);
+
+	for (i = 0; i < a.nfixups; i++){
+		for (j = 0; j < a.nlabels; j++)
+			if (a.labels[j].name == a.fixups[i].name)
+				break;
+		if (j == a.nlabels)
+			eval_err("undefined label", a.fixups[i].name);
+		a.insns[a.fixups[i].pos] = a.insns + a.labels[j].pos;
+	}
+	free(a.labels);
+	free(a.fixups);
+
+	/* nothing has been collected since the operands were read */
+	code = alloc_old(scm_code);
+	code->data.code.insns = a.insns;
+	code->data.code.length = a.length;
+	code->data.code.relocs = a.relocs;
+	code->data.code.nrelocs = a.nrelocs;
+	code->data.code.release = NULL;
+	for (i = 0; i < a.nrelocs; i++)
+		write_barrier(code, a.insns[a.relocs[i]]);
+	return code;
+}
+
+/*
+ * Object files
+ *
+ * Assembling a .sbc file means reading every instruction in it, so the
+ * result is cached beside it in a .sbo file, laid out so that it can be
+ * mapped straight into memory and patched in place. An object file is
+ * the header below followed by these sections, each 8 byte aligned:
+ *
+ *   code       the threaded code, a machine word each, with each opcode
+ *              as its number, each label as an index into the code and
+ *              each object operand as a value (see below)
+ *   opcodes    uint32 indices of the words of code that are opcodes
+ *   labels     uint32 indices of the words that are labels
+ *   objects    uint32 indices of the words that are heap objects
+ *   symbols    the symbol table: uint32 offsets of their names in strings
+ *   constants  the heap objects, as struct sbo_constant
+ *   strings    the NUL terminated names and contents of strings and
+ *              bytevectors, and bignums and flonums written out in decimal
+ *
+ * A value is an immediate object as it is, or a heap object as its
+ * index in constants shifted left three bits; the tag bits tell the two
+ * apart. A pair only refers to constants before it. The code section
+ * comes straight after the header, so the mapping can be found from the
+ * code object to unmap it.
+ *
+ * The header records a hash of the .sbc file the code was assembled
+ * from. If that doesn't match, or the object file was written by a
+ * different vm, the .sbc file is assembled again and the object file
+ * rewritten.
+ */
+
+#define SBO_MAGIC "SBO\n"
+#define SBO_VERSION 5               /* bump when INSTRUCTIONS or the layout changes */
+#define SBO_BYTE_ORDER 0x01020304
+
+enum sbo_kind {sbo_symbol, sbo_string, sbo_pair, sbo_number, sbo_vector, sbo_bytevector};
+
+struct sbo_constant {
+	uint64_t kind;
+	uint64_t a;                     /* index in symbols, offset in strings, the car or a vector's list */
+	uint64_t b;                     /* the cdr, or a string's or bytevector's length */
+};
+
+struct sbo_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t word_size;
+	uint32_t byte_order;
+	uint64_t source_hash;
+	uint64_t size;                  /* of the whole file */
+	uint32_t length;                /* of code, in words */
+	uint32_t nopcodes, nlabels, nobjects, nsymbols, nconstants, strings_size;
+	uint32_t opcodes, labels, objects, symbols, constants, strings; /* file offsets */
+	uint32_t unused;                /* pads the header to a multiple of 8 */
+};
+
+/* FNV-1a */
+static uint64_t hash_file(FILE *in)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	unsigned char buf[4096];
+	size_t n, i;
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		for (i = 0; i < n; i++)
+			hash = (hash ^ buf[i]) * 1099511628211ULL;
+	return hash;
+}
+
+/* foo.sbc -> foo.sbo, anything else gets .sbo added */
+static char *object_file_name(const char *source)
+{
+	size_t len = strlen(source);
+	char *name = malloc(len + 5);
+
+	if (name == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	strcpy(name, source);
+	if (len > 4 && !strcmp(name + len - 4, ".sbc"))
+		name[len - 1] = 'o';
+	else
+		strcat(name, ".sbo");
+	return name;
+}
+
+static size_t align8(size_t n)
+{
+	return (n + 7) & ~(size_t) 7;
+}
+
+/* reading */
+
+static void unmap_code(object *code)
+{
+	struct sbo_header *h = (struct sbo_header *) code->data.code.insns - 1;
+	munmap(h, h->size);
+}
+
+static int in_file(struct sbo_header *h, uint32_t offset, uint32_t n, size_t elem_size)
+{
+	return offset % 8 == 0 && offset <= h->size && n <= (h->size - offset) / elem_size;
+}
+
+/* the object a value stands for, with n constants made so far */
+static object *sbo_value(uint64_t value, object **constants, uint32_t n)
+{
+	if (value & TAG_MASK)
+		return (object *) (uintptr_t) value;
+	return (value >> 3) < n ? constants[value >> 3] : NULL;
+}
+
+/* the code in the object file at path, or NULL if it's missing, stale or corrupt */
+static object *load_object_file(char *path, uint64_t source_hash)
+{
+	struct stat st;
+	struct sbo_header *h;
+	struct sbo_constant *c;
+	char *base = MAP_FAILED, *strings;
+	uint32_t *symbols, *relocs;
+	object **constants = NULL, *obj, *code;
+	void **insns;
+	uintptr_t word;
+	uint32_t i;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) == 0 && st.st_size >= 0 && (size_t) st.st_size >= sizeof(*h))
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	h = (struct sbo_header *) base;
+	if (memcmp(h->magic, SBO_MAGIC, 4) || h->version != SBO_VERSION 
+		|| h->word_size != sizeof(void *) || h->byte_order != SBO_BYTE_ORDER
+		|| h->source_hash != source_hash || h->size != (uint64_t) st.st_size)
+		goto fail;
+	if (!in_file(h, sizeof(*h), h->length, sizeof(void *))
+		|| !in_file(h, h->opcodes, h->nopcodes, sizeof(uint32_t))
+		|| !in_file(h, h->labels, h->nlabels, sizeof(uint32_t))
+		|| !in_file(h, h->objects, h->nobjects, sizeof(uint32_t))
+		|| !in_file(h, h->symbols, h->nsymbols, sizeof(uint32_t))
+		|| !in_file(h, h->constants, h->nconstants, sizeof(*c))
+		|| !in_file(h, h->strings, h->strings_size, 1)
+		|| h->strings_size == 0 || base[h->strings + h->strings_size - 1] != '\0')
+		goto fail;
+	insns = (void **) (h + 1);
+	strings = base + h->strings;
+	symbols = (uint32_t *) (base + h->symbols);
+
+	/* nothing is collected until the code runs */
+	constants = malloc(h->nconstants * sizeof(object *) + 1);
+	if (constants == NULL)
+		goto fail;
+	for (i = 0; i < h->nconstants; i++){
+		c = (struct sbo_constant *) (base + h->constants) + i;
+		switch (c->kind){
+		case sbo_symbol:
+			if (c->a >= h->nsymbols || symbols[c->a] >= h->strings_size)
+				goto fail;
+			constants[i] = get_symbol(strings + symbols[c->a]);
+			break;
+		case sbo_string:
+			if (c->a >= h->strings_size || c->b >= h->strings_size - c->a)
+				goto fail;
+			constants[i] = make_str_len(strings + c->a, c->b);
+			break;
+		case sbo_pair:
+			if ((obj = sbo_value(c->a, constants, i)) == NULL
+				|| sbo_value(c->b, constants, i) == NULL)
+				goto fail;
+			constants[i] = cons(obj, sbo_value(c->b, constants, i));
+			break;
+		case sbo_vector:
+			if ((obj = sbo_value(c->a, constants, i)) == NULL)
+				goto fail;
+			constants[i] = list_to_vector(obj);
+			break;
+		case sbo_bytevector:
+			if (c->a >= h->strings_size || c->b >= h->strings_size - c->a)
+				goto fail;
+			constants[i] = make_bytevector(c->b, 0);
+			memcpy(bytevector_bytes(constants[i]), strings + c->a, c->b);
+			break;
+		case sbo_number:
+			if (c->a >= h->strings_size
+				|| (constants[i] = string_to_number(strings + c->a, 10)) == NULL)
+				goto fail;
+			break;
+		default:
+			goto fail;
+		}
+	}
+
+	relocs = (uint32_t *) (base + h->opcodes);
+	for (i = 0; i < h->nopcodes; i++){
+		if (relocs[i] >= h->length || (word = (uintptr_t) insns[relocs[i]]) >= num_opcodes)
+			goto fail;
+		insns[relocs[i]] = op_addresses[word];
+	}
+	relocs = (uint32_t *) (base + h->labels);
+	for (i = 0; i < h->nlabels; i++){
+		if (relocs[i] >= h->length || (word = (uintptr_t) insns[relocs[i]]) >= h->length)
+			goto fail;
+		insns[relocs[i]] = insns + word;
+	}
+	relocs = (uint32_t *) (base + h->objects);
+	for (i = 0; i < h->nobjects; i++){
+		if (relocs[i] >= h->length
+			|| (obj = sbo_value((uintptr_t) insns[relocs[i]], constants, h->nconstants)) == NULL)
+			goto fail;
+		insns[relocs[i]] = obj;
+	}
+	free(constants);
+
+	code = alloc_old(scm_code);
+	code->data.code.insns = insns;
+	code->data.code.length = h->length;
+	code->data.code.relocs = (int *) relocs;
+	code->data.code.nrelocs = h->nobjects;
+	code->data.code.release = unmap_code;
+	for (i = 0; i < h->nobjects; i++)
+		write_barrier(code, insns[relocs[i]]);
+	return code;
+
+fail:
+	free(constants);
+	munmap(base, st.st_size);
+	return NULL;
+}
+
+/* writing */
+
+struct table {
+	void *data;
+	int n, size;
+};
+
+static void *table_add(struct table *t, int elem_size)
+{
+	if (t->n == t->size)
+		t->data = grow_array(t->data, &t->size, elem_size);
+	return (char *) t->data + t->n++ * elem_size;
+}
+
+struct sbo_writer {
+	struct table opcodes, labels, objects, symbols; /* uint32_t */
+	struct table constants;         /* struct sbo_constant */
+	struct table written;           /* the object for each constant */
+	struct table strings;           /* char */
+	int failed;
+};
+
+static void add_index(struct table *t, uint32_t index)
+{
+	*(uint32_t *) table_add(t, sizeof(uint32_t)) = index;
+}
+
+static uint32_t add_chars(struct sbo_writer *w, char *chars, size_t length)
+{
+	uint32_t offset = w->strings.n;
+	size_t i;
+	for (i = 0; i < length; i++)
+		*(char *) table_add(&w->strings, 1) = chars[i];
+	*(char *) table_add(&w->strings, 1) = '\0';
+	return offset;
+}
+
+static uint32_t add_string(struct sbo_writer *w, char *str)
+{
+	return add_chars(w, str, strlen(str));
+}
+
+static uint64_t add_constant(struct sbo_writer *w, object *obj)
+{
+	struct sbo_constant c = {0};
+	char *text;
+	int i;
+
+	if (is_immediate(obj))
+		return (uintptr_t) obj;
+	for (i = 0; i < w->written.n; i++)
+		if (((object **) w->written.data)[i] == obj)
+			return (uint64_t) i << 3;
+
+	switch (obj->type){
+	case scm_symbol:
+		c.kind = sbo_symbol;
+		c.a = w->symbols.n;
+		add_index(&w->symbols, add_string(w, sym2str(obj)));
+		break;
+	case scm_str:
+		c.kind = sbo_string;
+		c.a = add_chars(w, obj2str(obj), str_length(obj));
+		c.b = str_length(obj);
+		break;
+	case scm_pair:
+		c.kind = sbo_pair;
+		c.a = add_constant(w, car(obj));
+		c.b = add_constant(w, cdr(obj));
+		break;
+	case scm_vector:
+		c.kind = sbo_vector;
+		c.a = add_constant(w, vector_to_list(obj, 0, vector_length(obj)));
+		break;
+	case scm_bytevector:
+		c.kind = sbo_bytevector;
+		c.a = add_chars(w, (char *) bytevector_bytes(obj), bytevector_length(obj));
+		c.b = bytevector_length(obj);
+		break;
+	case scm_bignum:
+	case scm_flonum:
+		text = number_to_string(obj, 10);
+		c.kind = sbo_number;
+		c.a = add_string(w, text);
+		free(text);
+		break;
+	default:
+		w->failed = 1;  /* quote only makes the types above */
+		return 0;
+	}
+	*(object **) table_add(&w->written, sizeof(object *)) = obj;
+	*(struct sbo_constant *) table_add(&w->constants, sizeof(c)) = c;
+	return (uint64_t) (w->constants.n - 1) << 3;
+}
+
+static int opcode_at(void *address)
+{
+	int op;
+	for (op = 0; op < num_opcodes; op++)
+		if (op_addresses[op] == address)
+			break;
+	return op;
+}
+
+/* writes data and pads it out to 8 bytes, returning the file offset after it */
+static uint32_t write_section(FILE *out, void *data, size_t size, uint32_t offset)
+{
+	static const char zeros[8];
+	fwrite(data, 1, size, out);
+	fwrite(zeros, 1, align8(size) - size, out);
+	return offset + align8(size);
+}
+
+/* caches code at path, or does nothing if it can't */
+static void write_object_file(char *path, object *code, uint64_t source_hash)
+{
+	struct sbo_writer w = {.failed = 0};
+	struct sbo_header h = {.version = 0};
+	void **insns = code->data.code.insns;
+	uintptr_t *words;
+	char *kind, *tmp;
+	uint32_t offset;
+	FILE *out;
+	int i, op, failed;
+
+	words = malloc(code->data.code.length * sizeof(uintptr_t));
+	if (words == NULL)
+		return;
+	add_string(&w, "");             /* so strings is never empty */
+	for (i = 0; i < code->data.code.length; ){
+		if ((op = opcode_at(insns[i])) == num_opcodes){
+			w.failed = 1;
+			break;
+		}
+		add_index(&w.opcodes, i);
+		words[i++] = op;
+		for (kind = instructions[op].operands; *kind; kind++, i++)
+			switch (*kind){
+			case 'o':
+				words[i] = add_constant(&w, insns[i]);
+				if (!is_immediate(insns[i]))
+					add_index(&w.objects, i);
+				break;
+			case 'i':
+				words[i] = (intptr_t) insns[i];
+				break;
+			case 'l':
+				words[i] = (void **) insns[i] - insns;
+				add_index(&w.labels, i);
+				break;
+			}
+	}
+
+	tmp = str_append(path, ".tmp");
+	if (w.failed || tmp == NULL || (out = fopen(tmp, "wb")) == NULL)
+		goto done;
+
+	memcpy(h.magic, SBO_MAGIC, 4);
+	h.version = SBO_VERSION;
+	h.word_size = sizeof(void *);
+	h.byte_order = SBO_BYTE_ORDER;
+	h.source_hash = source_hash;
+	h.length = code->data.code.length;
+	h.nopcodes = w.opcodes.n;
+	h.nlabels = w.labels.n;
+	h.nobjects = w.objects.n;
+	h.nsymbols = w.symbols.n;
+	h.nconstants = w.constants.n;
+	h.strings_size = w.strings.n;
+	h.opcodes = sizeof(h) + align8(h.length * sizeof(uintptr_t));
+	h.labels = h.opcodes + align8(h.nopcodes * sizeof(uint32_t));
+	h.objects = h.labels + align8(h.nlabels * sizeof(uint32_t));
+	h.symbols = h.objects + align8(h.nobjects * sizeof(uint32_t));
+	h.constants = h.symbols + align8(h.nsymbols * sizeof(uint32_t));
+	h.strings = h.constants + h.nconstants * sizeof(struct sbo_constant);
+	h.size = h.strings + align8(h.strings_size);
+
+	offset = write_section(out, &h, sizeof(h), 0);
+	offset = write_section(out, words, h.length * sizeof(uintptr_t), offset);
+	offset = write_section(out, w.opcodes.data, h.nopcodes * sizeof(uint32_t), offset);
+	offset = write_section(out, w.labels.data, h.nlabels * sizeof(uint32_t), offset);
+	offset = write_section(out, w.objects.data, h.nobjects * sizeof(uint32_t), offset);
+	offset = write_section(out, w.symbols.data, h.nsymbols * sizeof(uint32_t), offset);
+	offset = write_section(out, w.constants.data, h.nconstants * sizeof(struct sbo_constant), offset);
+	offset = write_section(out, w.strings.data, h.strings_size, offset);
+
+	/* renamed into place, so that a vm with the old file mapped keeps it */
+	failed = ferror(out) || offset != h.size;
+	if (fclose(out) != 0 || failed || rename(tmp, path) != 0)
+		remove(tmp);
+done:
+	free(tmp);
+	free(words);
+	free(w.opcodes.data);
+	free(w.labels.data);
+	free(w.objects.data);
+	free(w.symbols.data);
+	free(w.constants.data);
+	free(w.written.data);
+	free(w.strings.data);
+}
+
+/*
+ * The machine
+ */
+
+/* a frame for a call of the closure proc with the n arguments at args */
+static object *make_vm_frame(object *proc, object **args, int n)
+{
+	int nreq = proc->data.closure.nreq, size = proc->data.closure.frame_size, i;
+	object *frame, *rest = empty_list;
+
+	if (n < nreq)
+		eval_err("Not enough arguments to a function:", proc);
+	for (i = n; i > nreq; i--)
+		rest = cons(args[i - 1], rest);
+	if (rest != empty_list && !proc->data.closure.rest)
+		eval_err("Too many arguments to a function, excessive arguments are:", rest);
+
+	/* nothing is collected before the frame is filled in */
+	frame = alloc_frame(size);
+	frame->data.frame.parent = proc->data.closure.env;
+	for (i = 0; i < nreq; i++)
+		FRAME_SLOTS(frame)[i] = args[i];
+	if (proc->data.closure.rest)
+		FRAME_SLOTS(frame)[i++] = rest;
+	for (; i < size; i++)
+		FRAME_SLOTS(frame)[i] = NULL; /* unassigned internal definitions */
+	return frame;
+}
+
+/*
+ * For a call of the stack-closure proc with the n arguments below sp
+ * that doesn't pass exactly its required arguments: checks them, and
+ * replaces any beyond those with a list of them, returning the new sp.
+ */
+static object **rest_argument(object *proc, object **sp, int n)
+{
+	int nreq = proc->data.closure.nreq, i;
+	object *rest = empty_list;
+
+	if (n < nreq)
+		eval_err("Not enough arguments to a function:", proc);
+	for (i = n; i > nreq; i--)
+		rest = cons(sp[i - n - 1], rest);
+	if (n > nreq && !proc->data.closure.rest)
+		eval_err("Too many arguments to a function, excessive arguments are:", rest);
+	sp -= n - nreq;
+	*sp++ = rest;
+	return sp;
+}
+
+static object *list_from_stack(object **args, int n)
+{
+	object *list = empty_list;
+	while (n > 0)
+		list = cons(args[--n], list);
+	return list;
+}
+
+#define PUSH(x) (*sp++ = (x))
+#define POP() (*--sp)
+#define TOP (sp[-1])
+#define NEXT goto **pc++
+#define INT_OPERAND ((intptr_t) *pc++)
+#define OBJ_OPERAND ((object *) *pc++)
+#define TAG(ptr) ((object *) ((uintptr_t) (ptr) | FIXNUM_TAG))
+#define UNTAG(obj) ((void *) ((uintptr_t) (obj) & ~(uintptr_t) FIXNUM_TAG))
+
+#define ARITH(fn) \
+	do { \
+		object *b = POP(); \
+		TOP = fn(TOP, b); \
+	} while (0)
+#define COMPARE(result) \
+	do { \
+		object *b = POP(); \
+		TOP = make_bool(num_compare(TOP, b) == (result)); \
+	} while (0)
+
+/* runs code from the start until it halts; run(NULL) just sets op_addresses */
+static void run(object *code)
+{
+	static void *addresses[] = {
+#define X(op, name, operands) &&op,
+		INSTRUCTIONS
+#undef X
+	};
+	void **pc;
+	object **sp = vm_sp, **base = vm_sp, *env = NULL, *proc, *val, *args;
+	void **entry;
+	int i, n, size, tail, depth = gc_depth();
+
+	if (code == NULL){
+		op_addresses = addresses;
+		return;
+	}
+
+	gc_protect(&env);
+	gc_protect(&code);
+	pc = code->data.code.insns;
+	NEXT;
+
+op_halt:
+	vm_sp = sp;
+	gc_release(depth);
+	return;
+
+op_const:
+	PUSH(OBJ_OPERAND);
+	NEXT;
+
+op_local0:
+	val = FRAME_SLOTS(env)[INT_OPERAND];
+	if (val == NULL)
+		eval_err("unassigned variable in slot", make_int((intptr_t) pc[-1]));
+	PUSH(val);
+	NEXT;
+
+op_local:
+	for (val = env, n = INT_OPERAND; n > 0; n--)
+		val = val->data.frame.parent;
+	val = FRAME_SLOTS(val)[INT_OPERAND];
+	if (val == NULL)
+		eval_err("unassigned variable in slot", make_int((intptr_t) pc[-1]));
+	PUSH(val);
+	NEXT;
+
+op_set_local:
+	for (proc = env, n = INT_OPERAND; n > 0; n--)
+		proc = proc->data.frame.parent;
+	val = POP();
+	write_barrier(proc, val);
+	FRAME_SLOTS(proc)[INT_OPERAND] = val;
+	NEXT;
+
+op_arg:
+	val = base[INT_OPERAND];
+	if (val == NULL)
+		eval_err("unassigned variable in slot", make_int((intptr_t) pc[-1]));
+	PUSH(val);
+	NEXT;
+
+op_set_arg:
+	val = POP();
+	base[INT_OPERAND] = val; /* the stack is a root, so no write barrier */
+	NEXT;
+
+op_global:
+	val = OBJ_OPERAND;
+	if (val->data.sym.value == NULL)
+		eval_err("unbound variable", val);
+	PUSH(val->data.sym.value);
+	NEXT;
+
+op_set_global:
+	val = OBJ_OPERAND;
+	if (val->data.sym.value == NULL)
+		eval_err("unbound variable", val);
+	write_barrier(val, TOP);
+	val->data.sym.value = POP();
+	NEXT;
+
+op_define_global:
+	val = OBJ_OPERAND;
+	write_barrier(val, TOP);
+	val->data.sym.value = POP();
+	NEXT;
+
+op_pop:
+	sp--;
+	NEXT;
+
+op_dup:
+	val = TOP;
+	PUSH(val);
+	NEXT;
+
+op_goto:
+	pc = *pc;
+	NEXT;
+
+op_goto_if:
+	if (is_true(POP()))
+		pc = *pc;
+	else
+		pc++;
+	NEXT;
+
+op_closure:
+	val = alloc_obj(scm_closure);
+	val->data.closure.entry = *pc++;
+	val->data.closure.nreq = INT_OPERAND;
+	val->data.closure.rest = INT_OPERAND;
+	val->data.closure.frame_size = INT_OPERAND;
+	val->data.closure.env = env;
+	val->data.closure.code = code;
+	val->data.closure.stack_frame = 0;
+	val->data.closure.native = NULL;
+	PUSH(val);
+	NEXT;
+
+op_stack_closure:
+	val = alloc_obj(scm_closure);
+	val->data.closure.entry = *pc++;
+	val->data.closure.nreq = INT_OPERAND;
+	val->data.closure.rest = INT_OPERAND;
+	val->data.closure.frame_size = INT_OPERAND;
+	val->data.closure.env = env;
+	val->data.closure.code = code;
+	val->data.closure.stack_frame = 1;
+	val->data.closure.native = NULL;
+	PUSH(val);
+	NEXT;
+
+op_call:
+	tail = 0;
+	goto call_safely;
+
+op_tail_call:
+	tail = 1;
+call_safely:
+	n = INT_OPERAND;
+	vm_sp = sp;
+	gc_safe_point();
+call:
+	proc = sp[-n - 1];
+	if (is_heap_type(proc, scm_closure) && proc->data.closure.stack_frame){
+		if (n != proc->data.closure.nreq || proc->data.closure.rest){
+			sp = rest_argument(proc, sp, n);
+			n = proc->data.closure.nreq + proc->data.closure.rest;
+		}
+		size = proc->data.closure.frame_size;
+		if (sp + size + 4 >= stack_end - STACK_MARGIN)
+			eval_err("stack overflow in", proc);
+		/* the arguments are moved down over the frame a tail call replaces,
+		   or up to make room for a continuation under them */
+		if (tail){
+			for (i = 0; i < n; i++)
+				base[i] = sp[i - n];
+			sp = base + n;
+		} else {
+			sp -= n + 1;
+			for (i = n; i > 0; i--)
+				sp[i + 3] = sp[i];
+			PUSH(TAG(pc));
+			PUSH(make_int(base - stack));
+			PUSH(env);
+			PUSH(code);
+			base = sp;
+			sp += n;
+		}
+		while (sp < base + size)
+			PUSH(NULL);             /* unassigned internal definitions */
+		env = proc->data.closure.env;
+		code = proc->data.closure.code;
+		pc = proc->data.closure.entry;
+		NEXT;
+	}
+	if (is_heap_type(proc, scm_closure)){
+		val = make_vm_frame(proc, sp - n, n);
+		if (tail)
+			sp = base;
+		else {
+			sp -= n + 1;
+			if (sp >= stack_end - STACK_MARGIN)
+				eval_err("stack overflow in", proc);
+			PUSH(TAG(pc));
+			PUSH(make_int(base - stack));
+			PUSH(env);
+			PUSH(code);
+			base = sp;
+		}
+		env = val;
+		code = proc->data.closure.code;
+		pc = proc->data.closure.entry;
+		NEXT;
+	}
+	if (is_heap_type(proc, scm_lambda))
+		goto call_c;                /* made by load or eval */
+	if (!is_heap_type(proc, scm_prim_fun))
+		eval_err("not a function:", proc);
+
+	if (obj2prim_proc(proc) == apply_proc){
+		if (n != 2)
+			eval_err("APPLY takes a function and a list of arguments, not", list_from_stack(sp - n, n));
+		args = POP();
+		val = POP();
+		TOP = val;
+		for (n = 0; args != empty_list; args = cdr(args), n++){
+			if (sp >= stack_end - STACK_MARGIN)
+				eval_err("stack overflow in", val);
+			PUSH(car(args));
+		}
+		goto call;
+	}
+
+	/* a primitive doesn't need a continuation, even in a tail call */
+call_c:
+	args = list_from_stack(sp - n, n);
+	sp -= n + 1;
+	vm_sp = sp;
+	if (is_heap_type(proc, scm_lambda))
+		val = apply(proc, args);
+	else if (obj2prim_proc(proc) == eval_proc)
+		val = eval(car(args), cadr(args));
+	else
+		val = obj2prim_proc(proc)(args);
+	if (tail)
+		goto return_val;
+	PUSH(val);
+	NEXT;
+
+op_call_direct:
+	tail = 0;
+	goto call_direct;
+
+op_tail_call_direct:
+	tail = 1;
+call_direct:
+	entry = *pc++;
+	n = INT_OPERAND;
+	size = INT_OPERAND;
+	vm_sp = sp;
+	gc_safe_point();
+	/* the compiler has checked the arguments */
+	if (sp + size + 4 >= stack_end - STACK_MARGIN)
+		eval_err("stack overflow in a call to the code at", make_int(entry - code->data.code.insns));
+	if (tail){
+		for (i = 0; i < n; i++)
+			base[i] = sp[i - n];
+		sp = base + n;
+	} else {
+		sp -= n;
+		for (i = n; i > 0; i--)
+			sp[i + 3] = sp[i - 1];
+		PUSH(TAG(pc));
+		PUSH(make_int(base - stack));
+		PUSH(env);
+		PUSH(code);
+		base = sp;
+		sp += n;
+	}
+	while (sp < base + size)
+		PUSH(NULL);
+	env = NULL;
+	pc = entry;
+	NEXT;
+
+op_return:
+	val = POP();
+return_val:
+	sp = base;
+	code = POP();
+	env = POP();
+	base = stack + obj2int(POP());
+	pc = UNTAG(POP());
+	PUSH(val);
+	NEXT;
+
+op_car:
+	TOP = is_heap_type(TOP, scm_pair) ? TOP->data.pair.car : car(TOP); /* car reports the error */
+	NEXT;
+
+op_cdr:
+	TOP = is_heap_type(TOP, scm_pair) ? TOP->data.pair.cdr : cdr(TOP);
+	NEXT;
+
+op_cons:
+	val = POP();
+	TOP = cons(TOP, val);
+	NEXT;
+
+op_is_null:
+	TOP = make_bool(TOP == empty_list);
+	NEXT;
+
+op_is_pair:
+	TOP = make_bool(is_heap_type(TOP, scm_pair));
+	NEXT;
+
+op_not:
+	TOP = make_bool(TOP == false);
+	NEXT;
+
+op_eq:
+	val = POP();
+	TOP = make_bool(TOP == val);
+	NEXT;
+
+op_add:
+	ARITH(num_add);
+	NEXT;
+
+op_sub:
+	ARITH(num_sub);
+	NEXT;
+
+op_mul:
+	ARITH(num_mul);
+	NEXT;
+
+op_num_eq:
+	COMPARE(0);
+	NEXT;
+
+op_lt:
+	COMPARE(-1);
+	NEXT;
+
+op_gt:
+	COMPARE(1);
+	NEXT;
+}
+
+/* calls proc with the list args, for the interpreter's apply_closure */
+static object *apply_vm_closure(object *proc, object *args)
+{
+	object **sp = vm_sp;
+
+	if (sp + 3 >= stack_end - STACK_MARGIN)
+		eval_err("stack overflow in", proc);
+	PUSH(apply_prim);
+	PUSH(proc);
+	PUSH(args);
+	vm_sp = sp;
+	run(apply_code);
+	return *--vm_sp;
+}
+
+static void init_vm(void)
+{
+	void **insns;
+	int i;
+
+	stack = malloc(STACK_SIZE * sizeof(object *));
+	if (stack == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	stack_end = stack + STACK_SIZE;
+	vm_sp = stack;
+	gc_protect_stack(stack, &vm_sp);
+
+	for (i = 0; i < num_opcodes; i++)
+		if (instructions[i].name != NULL)
+			instructions[i].sym = get_symbol(instructions[i].name);
+	label_symbol = get_symbol("LABEL");
+	run(NULL);
+
+	insns = malloc(3 * sizeof(void *));
+	if (insns == NULL){
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	insns[0] = op_addresses[op_call];
+	insns[1] = (void *) 2;
+	insns[2] = op_addresses[op_halt];
+	apply_code = alloc_old(scm_code);
+	apply_code->data.code.insns = insns;
+	apply_code->data.code.length = 3;
+	apply_code->data.code.relocs = NULL;
+	apply_code->data.code.nrelocs = 0;
+	apply_code->data.code.release = NULL;
+	apply_prim = make_prim_fun(apply_proc, "APPLY");
+	gc_protect(&apply_code);
+	gc_protect(&apply_prim);
+	apply_closure = apply_vm_closure;
+}
+
+int main(int argc, const char **argv)
+{
+	FILE *in;
+	source *src;
+	object *code;
+	char *object_file;
+	uint64_t hash;
+	int i;
+
+	if (argc < 2){
+		fprintf(stderr, "Usage: %s file.sbc ...\n", argv[0]);
+		return 1;
+	}
+
+	init_constants();
+	init_enviroment(global_enviroment);
+	set_arg_var(argc, argv);
+	init_vm();
+
+	for (i = 1; i < argc; i++){
+		if ((in = fopen(argv[i], "r")) == NULL){
+			fprintf(stderr, "Could not open %s.\n", argv[i]);
+			return 1;
+		}
+		hash = hash_file(in);
+		object_file = object_file_name(argv[i]);
+		if ((code = load_object_file(object_file, hash)) == NULL){
+			/* opened again, as the reader doesn't read through stdio */
+			if ((in = freopen(argv[i], "r", in)) == NULL){
+				fprintf(stderr, "Could not open %s.\n", argv[i]);
+				return 1;
+			}
+			src = open_source(in);
+			code = assemble(src);
+			write_object_file(object_file, code, hash);
+			close_source(src);
+		} else fclose(in);
+		free(object_file);
+		run(code);
+	}
+	return 0;
+}